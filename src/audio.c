@@ -2,11 +2,17 @@
 
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <AL/alext.h>
+#include <errno.h>
+#include <libavutil/mem.h>
 #include <libavutil/time.h>
 #include <libswresample/swresample.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
@@ -17,9 +23,46 @@
 #define NB_AL_BUFFER 128
 static ALCdevice *a_dev;
 static ALCcontext *a_ctx;
-static ALuint a_buf[NB_AL_BUFFER];
 static ALuint a_src;
 
+/**
+ * 与AL缓冲一一对应的帧信息
+ */
+typedef struct {
+    /** 缓冲中第一个采样的时间，单位：微秒 */
+    int64_t pts;
+    /** 缓冲的时长，单位：微秒 */
+    int64_t duration;
+    int nb_samples, sample_rate;
+} BufferInfo;
+
+/**
+ * AL缓冲环：初始化时一次性生成所有AL缓冲，之后循环使用。
+ * AL按入队顺序处理缓冲，所以[buf_head, buf_head + buf_queued)始终是已入队的
+ * 缓冲，其余都是空闲缓冲，出队的缓冲直接回到空闲部分等待重新填充
+ */
+static ALuint a_buf[NB_AL_BUFFER];
+static BufferInfo buf_info[NB_AL_BUFFER];
+static int buf_head, buf_queued;
+/** 已入队缓冲的总时长，单位：微秒 */
+static int64_t buf_queued_duration;
+
+/**
+ * AL_SOFT_source_latency扩展：可以同时获取采样偏移和设备的输出延迟，
+ * 不支持该扩展时为NULL
+ */
+static LPALGETSOURCEI64VSOFT get_source_i64v;
+
+/**
+ * AL_SOFT_events扩展：AL播放完一个缓冲之后通过回调通知播放线程，播放线程
+ * 只在有缓冲可以回收时才被唤醒，而不是定时轮询。不支持该扩展时退回到轮询
+ */
+static int use_al_events;
+static pthread_mutex_t completed_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t completed_cond;
+/** 回调通知的、还未被播放线程处理的缓冲数量 */
+static int completed_buffers;
+
 static void check_al_error(const char *msg) {
     ALuint error;
     if ((error = alGetError()) != AL_NO_ERROR) {
@@ -28,42 +71,134 @@ static void check_al_error(const char *msg) {
     }
 }
 
-// 转为双声道、Signed 16-bits int
-static AVFrame *convert_frame_to_stereo_s16(const AVFrame *frame) {
+/**
+ * 重采样：SwrContext只在输入参数变化时重新创建，这样内部状态可以跨帧保留，
+ * 帧与帧之间可以无缝衔接。输出采样率与设备的混音采样率一致，避免AL再重采样一次
+ */
+static SwrContext *swr_ctx = NULL;
+static struct {
+    enum AVSampleFormat format;
+    int sample_rate;
+    AVChannelLayout ch_layout;
+} swr_in;
+/** 设备的混音采样率，获取不到时为0，表示与输入一致 */
+static int out_sample_rate;
+
+static int get_out_sample_rate(const AVFrame *frame) {
+    return out_sample_rate > 0 ? out_sample_rate : frame->sample_rate;
+}
+
+static void update_swr_context(const AVFrame *frame) {
+    AVChannelLayout cl = AV_CHANNEL_LAYOUT_STEREO;
+    if (swr_ctx && swr_in.format == frame->format &&
+        swr_in.sample_rate == frame->sample_rate &&
+        av_channel_layout_compare(&swr_in.ch_layout, &frame->ch_layout) == 0) {
+        return;
+    }
+    swr_free(&swr_ctx);
+    swr_alloc_set_opts2(&swr_ctx, &cl, AV_SAMPLE_FMT_S16,
+                        get_out_sample_rate(frame),
+                        (AVChannelLayout *) &frame->ch_layout, frame->format,
+                        frame->sample_rate, 0, NULL);
+    if (!swr_ctx || swr_init(swr_ctx) != 0) {
+        logAudioE("swr_init failed\n");
+        exit(-1);
+    }
+    swr_in.format = frame->format;
+    swr_in.sample_rate = frame->sample_rate;
+    av_channel_layout_uninit(&swr_in.ch_layout);
+    av_channel_layout_copy(&swr_in.ch_layout, &frame->ch_layout);
+    logAudio("[audio-play] resample %s %dHz -> s16 stereo %dHz\n",
+             av_get_sample_fmt_name(frame->format), frame->sample_rate,
+             get_out_sample_rate(frame));
+}
+
+/**
+ * 音频不是主时钟时，根据音频与主时钟的差值计算这一帧期望的采样数：
+ * 音频超前时多输出一些采样，落后时少输出一些，通过重采样逐渐追上主时钟
+ */
+static int get_wanted_samples(PlayContext *pc, const AVFrame *frame) {
+    StreamContext *sc = pc->audio_sc;
+    int nb_samples = frame->nb_samples;
+
+    if (pc->clock_master == CLOCK_MASTER_AUDIO ||
+        pc->state == STATE_PLAY_SEEKING || pc->state == STATE_PAUSE_SEEKING) {
+        return nb_samples;
+    }
+    if (pc->clock_master == CLOCK_MASTER_EXTERNAL) {
+        sync_external_clock(pc, clock_get(&sc->clock));
+    }
+    int64_t diff = clock_get(&sc->clock) - get_master_clock(pc);
+    if (diff > -AUDIO_SYNC_THRESHOLD && diff < AUDIO_SYNC_THRESHOLD) {
+        return nb_samples;
+    }
+    if (diff <= -AUDIO_NOSYNC_THRESHOLD || diff >= AUDIO_NOSYNC_THRESHOLD) {
+        // 差距过大时多半是时间戳有问题，不做补偿
+        return nb_samples;
+    }
+    int wanted = nb_samples + diff * frame->sample_rate / 1000 / 1000;
+    int max_delta = nb_samples * AUDIO_MAX_COMPENSATION_PERCENT / 100;
+    wanted = av_clip(wanted, nb_samples - max_delta, nb_samples + max_delta);
+    logAudio("[audio-play] compensating, diff=%ld, samples=%d -> %d\n", diff,
+             nb_samples, wanted);
+    return wanted;
+}
+
+// 转为双声道、Signed 16-bits int，采样率与设备一致；
+// wanted_samples与帧的采样数不同时，通过重采样拉伸或压缩
+static AVFrame *convert_frame_to_stereo_s16(StreamContext *sc,
+                                            const AVFrame *frame,
+                                            int wanted_samples) {
     int ret;
-    SwrContext *ctx = NULL;
     AVChannelLayout cl = AV_CHANNEL_LAYOUT_STEREO;
+    const int out_rate = get_out_sample_rate(frame);
 
-    if (frame->format == AV_SAMPLE_FMT_S16 &&
-        av_channel_layout_compare(&cl, &frame->ch_layout) == 0) {
+    if (frame->format == AV_SAMPLE_FMT_S16 && frame->sample_rate == out_rate &&
+        av_channel_layout_compare(&cl, &frame->ch_layout) == 0 && !swr_ctx &&
+        wanted_samples == frame->nb_samples) {
         // 已经是正确的格式，复制新的AVFrame，同时共享Buffer
         AVFrame *newFrame = av_frame_alloc();
         av_frame_ref(newFrame, frame);
         return newFrame;
     }
 
-    // TODO 共享Context
-    swr_alloc_set_opts2(&ctx, &cl, AV_SAMPLE_FMT_S16, frame->sample_rate,
-                        (AVChannelLayout *) &frame->ch_layout, frame->format,
-                        frame->sample_rate, 0, NULL);
-    if (swr_init(ctx) != 0) {
-        logAudio("swr_init failed");
-        exit(-1);
+    update_swr_context(frame);
+    if (wanted_samples != frame->nb_samples) {
+        // 在这一帧的时长内完成补偿
+        ret = swr_set_compensation(
+            swr_ctx,
+            (int64_t) (wanted_samples - frame->nb_samples) * out_rate /
+                frame->sample_rate,
+            (int64_t) wanted_samples * out_rate / frame->sample_rate);
+        if (ret < 0) {
+            averror(ret, "swr_set_compensation");
+        }
     }
+    // 重采样器中还缓存着上一帧的部分采样，输出的第一个采样要往前推这部分时长
+    int64_t delay = swr_get_delay(swr_ctx, out_rate);
 
-    const int samples = frame->nb_samples;
     AVFrame *outFrame = av_frame_alloc();
     av_frame_copy_props(outFrame, frame);
     outFrame->format = AV_SAMPLE_FMT_S16;
-    outFrame->nb_samples = samples;
-    av_channel_layout_copy(&outFrame->ch_layout, &frame->ch_layout);
+    outFrame->sample_rate = out_rate;
+    outFrame->nb_samples = swr_get_out_samples(
+        swr_ctx, FFMAX(wanted_samples, frame->nb_samples));
+    av_channel_layout_copy(&outFrame->ch_layout, &cl);
     if ((ret = av_frame_get_buffer(outFrame, 1)) != 0) {
         averror(ret, "av_frame_get_buffer");
     }
 
-    swr_convert(ctx, outFrame->data, samples, (const uint8_t **) frame->data,
-                samples);
-    swr_free(&ctx);
+    ret = swr_convert(swr_ctx, outFrame->data, outFrame->nb_samples,
+                      (const uint8_t **) frame->data, frame->nb_samples);
+    if (ret < 0) {
+        averror(ret, "swr_convert");
+    }
+    outFrame->nb_samples = ret;
+    if (frame->pts != AV_NOPTS_VALUE) {
+        outFrame->pts =
+            frame->pts - av_rescale_q(delay, (AVRational){1, out_rate},
+                                      sc->stream->time_base);
+    }
     return outFrame;
 }
 
@@ -81,66 +216,267 @@ static char *get_source_state_name(ALuint state) {
     return "unknown";
 }
 
-// TODO 该队列可以同时用来维护AL队列的其他信息，如帧时长等
-static Queue pts_queue;
-
-static void alloc_buffer_and_queue(StreamContext *sc, const AVFrame *frame) {
-    ALuint buf;
-    // TODO 复用Buffer
-    alGenBuffers(1, &buf);
-    alBufferData(buf, AL_FORMAT_STEREO16, frame->data[0], frame->linesize[0],
-                 frame->sample_rate);
+static void alloc_buffer_and_queue(const int16_t *data, int nb_samples,
+                                   int sample_rate, int64_t pts) {
+    if (buf_queued >= NB_AL_BUFFER) {
+        logAudioE("no free AL buffer\n");
+        exit(-1);
+    }
+    int index = (buf_head + buf_queued) % NB_AL_BUFFER;
+    ALuint buf = a_buf[index];
+    alBufferData(buf, AL_FORMAT_STEREO16, data,
+                 nb_samples * 2 * sizeof(int16_t), sample_rate);
     check_al_error("alBufferData");
     alSourceQueueBuffers(a_src, 1, &buf);
     check_al_error("alSourceQueueBuffers");
-    queue_enqueue(&pts_queue, (void *) pts_to_microseconds(
-                                  sc, frame->pts));  // TODO 32bit support
+
+    buf_info[index] = (BufferInfo){
+        .pts = pts,
+        .duration = (int64_t) nb_samples * 1000 * 1000 / sample_rate,
+        .nb_samples = nb_samples,
+        .sample_rate = sample_rate,
+    };
+    buf_queued++;
+    buf_queued_duration += buf_info[index].duration;
+}
+
+/**
+ * 回环设备（ALC_SOFT_loopback）：AL不再输出到声卡，而是由我们自己的线程调用
+ * alcRenderSamplesSOFT按需取走混音结果并丢弃，用于没有声卡的机器
+ */
+static LPALCRENDERSAMPLESSOFT render_samples;
+static pthread_t loopback_thread;
+static atomic_int loopback_running;
+/** 快速模式下没有数据可以渲染时，渲染线程在这里等待播放开始 */
+static pthread_mutex_t loopback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loopback_cond;
+
+static enum AudioBackend audio_backend = AUDIO_BACKEND_OPENAL;
+
+void set_audio_backend(enum AudioBackend backend) {
+    audio_backend = backend;
+}
+
+static int is_loopback_fast() {
+    return audio_backend == AUDIO_BACKEND_LOOPBACK_FAST;
+}
+
+static void wake_loopback() {
+    if (is_loopback_fast()) {
+        pthread_mutex_lock(&loopback_lock);
+        pthread_cond_signal(&loopback_cond);
+        pthread_mutex_unlock(&loopback_lock);
+    }
+}
+
+/**
+ * 根据正在播放的缓冲的pts和其中的采样偏移计算音频时间，并减去设备的输出延迟，
+ * 这样音频时间不再按整个缓冲跳变
+ */
+static void update_audio_clock(StreamContext *sc) {
+    ALint state;
+    int64_t offset, latency = 0;
+
+    if (buf_queued == 0) {
+        return;
+    }
+    alGetSourcei(a_src, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING) {
+        // 停止或缓冲耗尽时偏移归零，按队列头部计算会让时钟向后跳，
+        // 这时冻结在当前的值，等再次播放之后再更新
+        clock_set_speed(&sc->clock, 0);
+        return;
+    }
+    if (get_source_i64v) {
+        ALint64SOFT values[2];
+        get_source_i64v(a_src, AL_SAMPLE_OFFSET_LATENCY_SOFT, values);
+        offset = values[0] >> 32;    // 32.32定点数
+        latency = values[1] / 1000;  // ns -> us
+    } else {
+        ALint value;
+        alGetSourcei(a_src, AL_SAMPLE_OFFSET, &value);
+        offset = value;
+    }
+    // 偏移相对于队列中第一个缓冲，即使期间又播放完了一个缓冲，
+    // 由于缓冲的时间是连续的，结果仍然正确
+    const BufferInfo *info = &buf_info[buf_head];
+    // 两次更新之间由读者按速率外推；快速回环模式下渲染的速度不是1倍，
+    // 不外推，时钟只反映实际取走的采样
+    clock_update(&sc->clock,
+                 info->pts + offset * 1000 * 1000 / info->sample_rate - latency,
+                 is_loopback_fast() ? 0 : 1);
 }
 
 static int free_buffers(StreamContext *sc) {
     ALint processed;
+    ALuint buffers[NB_AL_BUFFER];
     alGetSourcei(a_src, AL_BUFFERS_PROCESSED, &processed);
     if (processed > 0) {
-        ALuint *buffers = malloc(sizeof(ALint) * processed);
+        // 出队顺序与入队顺序一致，出队的就是环头部的缓冲
         alSourceUnqueueBuffers(a_src, processed, buffers);
-        alDeleteBuffers(processed, buffers);
+        check_al_error("alSourceUnqueueBuffers");
 
-        int64_t last_pts;
+        const BufferInfo *last = NULL;
         for (int i = 0; i < processed; i++) {
-            last_pts = (int64_t) queue_dequeue(&pts_queue);
+            last = &buf_info[buf_head];
+            buf_queued_duration -= last->duration;
+            buf_head = (buf_head + 1) % NB_AL_BUFFER;
         }
-        sc->play_time = last_pts;
+        buf_queued -= processed;
+        // 队列中没有缓冲时，就是已播放完的最后一个缓冲的结束时间
+        clock_update(&sc->clock, last->pts + last->duration, 0);
+    }
+    update_audio_clock(sc);
+    if (processed > 0) {
         logAudio("[audio-play] time updated: curr_time=%lf\n",
-                 sc->play_time / (double) 1000.0 / 1000);
+                 clock_get(&sc->clock) / (double) 1000.0 / 1000);
     }
     return processed;
 }
 
-// TODO 以时间为单位，而不是帧数量
-#define MAX_QUEUED_FRAMES 50
-#define IDLE_WAIT_FRAMES 2
+static void ensure_playing() {
+    ALint state;
+    alGetSourcei(a_src, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING) {
+        alSourcePlay(a_src);
+        check_al_error("alSourcePlay");
+        wake_loopback();
+    }
+}
+
+/**
+ * 在AL的事件线程中调用
+ */
+static void AL_APIENTRY on_al_event(ALenum type, ALuint object, ALuint param,
+                                    ALsizei length, const ALchar *message,
+                                    void *user) {
+    if (type != AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT) {
+        return;
+    }
+    pthread_mutex_lock(&completed_lock);
+    completed_buffers += param;  // param为播放完的缓冲数量
+    pthread_cond_signal(&completed_cond);
+    pthread_mutex_unlock(&completed_lock);
+}
+
+static void init_al_events() {
+    if (!alIsExtensionPresent("AL_SOFT_events")) {
+        return;
+    }
+    LPALEVENTCONTROLSOFT event_control =
+        alGetProcAddress("alEventControlSOFT");
+    LPALEVENTCALLBACKSOFT event_callback =
+        alGetProcAddress("alEventCallbackSOFT");
+    if (!event_control || !event_callback) {
+        return;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&completed_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    const ALenum types[] = {AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT};
+    event_callback(on_al_event, NULL);
+    event_control(1, types, AL_TRUE);
+    use_al_events = 1;
+}
+
+/**
+ * 等待AL播放完至少一个缓冲，最多等待timeout微秒
+ */
+static void wait_buffer_completed(int64_t timeout) {
+    if (!use_al_events) {
+        av_usleep(timeout);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t nano = timeout * 1000 + ts.tv_nsec;
+    ts.tv_nsec = nano % (1000 * 1000 * 1000);
+    ts.tv_sec += nano / (1000 * 1000 * 1000);
+
+    pthread_mutex_lock(&completed_lock);
+    while (completed_buffers == 0) {
+        if (pthread_cond_timedwait(&completed_cond, &completed_lock, &ts) ==
+            ETIMEDOUT) {
+            break;
+        }
+    }
+    completed_buffers = 0;
+    pthread_mutex_unlock(&completed_lock);
+}
 
 /**
  * 不断更新播放时间直到AL播放完成
  */
 void wait_remain_buffers(StreamContext *sc) {
     logAudio("[audio-play] EOS\n");
-    ALint queued;
     for (;;) {
         free_buffers(sc);
-        alGetSourcei(a_src, AL_BUFFERS_QUEUED, &queued);
-        if (queued <= 0) {
+        if (buf_queued <= 0) {
             break;
         }
-        // 等待n帧 IDLE_WAIT_FRAMES
-        av_usleep(1000 * 20);
+        wait_buffer_completed(AUDIO_BUFFER_DURATION);
     }
 }
 
-static void play_audio_frame(StreamContext *sc, const AVFrame *frame) {
-    static int pos_in;
-    ALuint buf;
+/**
+ * 等待AL队列有空间之后，将一个缓冲入队
+ *
+ * 1. 清理已经播放的数据，给队列腾出空间；
+ * 2. 如果队列中的总时长加上该缓冲不超过AUDIO_MAX_QUEUED_DURATION，则入队；
+ * 3. 否则等待一个缓冲的时间，并跳转至Step1重新检查。
+ */
+static void queue_buffer(StreamContext *sc, const int16_t *data,
+                         int nb_samples, int sample_rate, int64_t pts) {
+    int64_t duration = (int64_t) nb_samples * 1000 * 1000 / sample_rate;
+    for (;;) {
+        free_buffers(sc);
+        // 队列为空时总是可以入队，避免单个缓冲超过上限时无法入队
+        if (buf_queued == 0 ||
+            (buf_queued < NB_AL_BUFFER &&
+             buf_queued_duration + duration <= AUDIO_MAX_QUEUED_DURATION)) {
+            break;
+        }
+        ensure_playing();
+        // 有事件通知时，超时只是兜底
+        wait_buffer_completed(use_al_events ? AUDIO_MAX_QUEUED_DURATION
+                                            : AUDIO_BUFFER_DURATION);
+    }
+    alloc_buffer_and_queue(data, nb_samples, sample_rate, pts);
+    ensure_playing();
+}
 
+/**
+ * 音频打包：解码出来的帧通常很短（AAC 1024个采样，MP3 1152个采样），
+ * 将转换之后的采样合并成AUDIO_BUFFER_DURATION时长的缓冲再交给AL，
+ * 减少AL调用次数，输出延迟也不再取决于编码格式
+ */
+static struct {
+    /** 交错的双声道采样 */
+    int16_t *data;
+    /** 缓冲可容纳的采样数、已有的采样数 */
+    int capacity, nb_samples;
+    int sample_rate;
+    /** 缓冲中第一个采样的时间、下一个采样的时间，单位：微秒 */
+    int64_t pts, next_pts;
+} packer;
+
+static void packer_flush(StreamContext *sc) {
+    if (packer.nb_samples > 0) {
+        queue_buffer(sc, packer.data, packer.nb_samples, packer.sample_rate,
+                     packer.pts);
+        packer.nb_samples = 0;
+    }
+}
+
+static void packer_reset() {
+    packer.nb_samples = 0;
+}
+
+static void play_audio_frame(StreamContext *sc, const AVFrame *frame) {
     if (frame->format != AV_SAMPLE_FMT_S16) {
         logAudioE("frame format is %s, not %s\n",
                   av_get_sample_fmt_name(frame->format),
@@ -148,70 +484,178 @@ static void play_audio_frame(StreamContext *sc, const AVFrame *frame) {
         exit(-1);
     }
 
-    // 1. 清理已经播放的数据，给队列腾出空间；
-    // 2. 如果音频队列未满，则将数据入队，并跳转至Step4；
-    // 3. 如果音频队列已满，则等待一帧的时间，并跳转至Step2重新检查；
-    // 4. 更新当前时间；
-    // 5. 结束。
-
-    /* 统计速率 */
-    /* static int64_t last_pts = 0, last_msec = 0; */
-    /* alGetSourcei(a_src, AL_SOURCE_STATE, &state); */
-    /* alGetSourcei(a_src, AL_BUFFERS_QUEUED, &queued); */
-    /* alGetSourcei(a_src, AL_BUFFERS_PROCESSED, &processed); */
-    /* int64_t curr_msec = get_time_millisec(); */
-    /* logAudio( */
-    /* "frame: queued=%d, processed=%d, state=%s; pts=%ld, " */
-    /* "pts_diff=%ld, pkt_diff=%ld\n", */
-    /* queued, processed, get_source_state_name(state), frame->pts, */
-    /* frame->pts - last_pts, curr_msec - last_msec); */
-    /* last_pts = frame->pts; */
-    /* last_msec = curr_msec; */
-
-    ALint state, queued, processed;
-
-    for (int n = 0;; n++) {  // 等待队列有空间
-        free_buffers(sc);
-        alGetSourcei(a_src, AL_BUFFERS_QUEUED, &queued);
-        if (queued < MAX_QUEUED_FRAMES) {
-            break;
+    if (packer.sample_rate != frame->sample_rate) {
+        packer_flush(sc);
+        packer.sample_rate = frame->sample_rate;
+        packer.capacity = (int64_t) AUDIO_BUFFER_DURATION *
+                          frame->sample_rate / 1000 / 1000;
+        packer.data = av_realloc(packer.data,
+                                 packer.capacity * 2 * sizeof(int16_t));
+        if (!packer.data) {
+            error("av_realloc");
+        }
+    }
+
+    // 没有pts时接着上一帧的时间
+    int64_t pts = frame->pts != AV_NOPTS_VALUE
+                      ? pts_to_microseconds(sc, frame->pts)
+                      : packer.next_pts;
+    const int16_t *src = (const int16_t *) frame->data[0];
+    for (int offset = 0; offset < frame->nb_samples;) {
+        if (packer.nb_samples == 0) {
+            packer.pts = pts + (int64_t) offset * 1000 * 1000 /
+                                   frame->sample_rate;
         }
-        alGetSourcei(a_src, AL_SOURCE_STATE, &state);
-        if (state != AL_PLAYING) {
-            alSourcePlay(a_src);
-            check_al_error("alSourcePlay");
+        int n = FFMIN(packer.capacity - packer.nb_samples,
+                      frame->nb_samples - offset);
+        memcpy(packer.data + packer.nb_samples * 2, src + offset * 2,
+               n * 2 * sizeof(int16_t));
+        packer.nb_samples += n;
+        offset += n;
+        if (packer.nb_samples == packer.capacity) {
+            packer_flush(sc);
         }
-        // 等待n帧 IDLE_WAIT_FRAMES
-        av_usleep(
-            pts_to_microseconds(sc, frame->nb_samples * IDLE_WAIT_FRAMES));
     }
+    packer.next_pts =
+        pts + (int64_t) frame->nb_samples * 1000 * 1000 / frame->sample_rate;
+}
 
-    alloc_buffer_and_queue(sc, frame);
-    alGetSourcei(a_src, AL_BUFFERS_QUEUED, &queued);
+/**
+ * 快速模式下，音源没有在播放（暂停、seek或缓冲耗尽）时没有需要渲染的数据，
+ * 等待播放开始，最多等待一个周期，避免空转占满一个核心
+ */
+static void wait_loopback_source() {
+    ALint state;
     alGetSourcei(a_src, AL_SOURCE_STATE, &state);
-    if (state != AL_PLAYING) {
-        alSourcePlay(a_src);
-        check_al_error("alSourcePlay");
+    if (state == AL_PLAYING) {
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t nano = (int64_t) LOOPBACK_PERIOD * 1000 + deadline.tv_nsec;
+    deadline.tv_nsec = nano % (1000 * 1000 * 1000);
+    deadline.tv_sec += nano / (1000 * 1000 * 1000);
+    pthread_mutex_lock(&loopback_lock);
+    pthread_cond_timedwait(&loopback_cond, &loopback_lock, &deadline);
+    pthread_mutex_unlock(&loopback_lock);
+}
+
+static void *loopback_render_thread(void *arg) {
+    const int samples = (int64_t) LOOPBACK_PERIOD * LOOPBACK_FREQUENCY /
+                        1000 / 1000;
+    int16_t *buf = av_malloc(samples * 2 * sizeof(int16_t));
+    struct timespec next;
+
+    logAudio("[audio-loopback] tid=%lu, period=%dus, fast=%d\n",
+             pthread_self(), LOOPBACK_PERIOD,
+             is_loopback_fast());
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load(&loopback_running)) {
+        if (is_loopback_fast()) {
+            wait_loopback_source();
+            render_samples(a_dev, buf, samples);
+            continue;
+        }
+        render_samples(a_dev, buf, samples);
+        // 按绝对时间等待，避免误差累积
+        int64_t nano = (int64_t) LOOPBACK_PERIOD * 1000 + next.tv_nsec;
+        next.tv_nsec = nano % (1000 * 1000 * 1000);
+        next.tv_sec += nano / (1000 * 1000 * 1000);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    av_free(buf);
+    return NULL;
+}
+
+static ALCdevice *open_loopback_device() {
+    if (!alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")) {
+        logAudioE("ALC_SOFT_loopback not supported\n");
+        return NULL;
+    }
+    LPALCLOOPBACKOPENDEVICESOFT loopback_open_device =
+        alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+    LPALCISRENDERFORMATSUPPORTEDSOFT is_render_format_supported =
+        alcGetProcAddress(NULL, "alcIsRenderFormatSupportedSOFT");
+    render_samples = alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+
+    ALCdevice *dev = loopback_open_device(NULL);
+    if (!dev) {
+        return NULL;
+    }
+    if (!is_render_format_supported(dev, LOOPBACK_FREQUENCY, ALC_STEREO_SOFT,
+                                    ALC_SHORT_SOFT)) {
+        logAudioE("loopback render format not supported\n");
+        alcCloseDevice(dev);
+        return NULL;
+    }
+    return dev;
+}
+
+static void start_loopback() {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&loopback_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    atomic_store(&loopback_running, 1);
+    pthread_create(&loopback_thread, NULL, loopback_render_thread, NULL);
+}
+
+static void stop_loopback() {
+    if (atomic_exchange(&loopback_running, 0)) {
+        pthread_join(loopback_thread, NULL);
     }
 }
 
 void init_audio_play() {
-    a_dev = alcOpenDevice(NULL);
+    const ALCint loopback_attrs[] = {
+        ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+        ALC_FORMAT_TYPE_SOFT,     ALC_SHORT_SOFT,
+        ALC_FREQUENCY,            LOOPBACK_FREQUENCY,
+        0,
+    };
+
+    if (audio_backend == AUDIO_BACKEND_OPENAL) {
+        a_dev = alcOpenDevice(NULL);
+        if (!a_dev) {
+            // 没有声卡时退回到回环设备，保证播放流程可以继续
+            logAudioE("failed to open audio device, fallback to loopback\n");
+            audio_backend = AUDIO_BACKEND_LOOPBACK;
+        }
+    }
+    if (audio_backend != AUDIO_BACKEND_OPENAL) {
+        a_dev = open_loopback_device();
+    }
     if (!a_dev) {
         logAudioE("failed to open audio device\n");
-        goto end;
+        exit(-1);
     }
     logAudio("open device %s\n", alcGetString(a_dev, ALC_DEVICE_SPECIFIER));
-    a_ctx = alcCreateContext(a_dev, NULL);
+    a_ctx = alcCreateContext(
+        a_dev, audio_backend == AUDIO_BACKEND_OPENAL ? NULL : loopback_attrs);
     if (!a_ctx) {
-        logAudioE("alCreateContext failed");
-        goto end;
+        logAudioE("alCreateContext failed\n");
+        exit(-1);
     }
     alcMakeContextCurrent(a_ctx);
+    alcGetIntegerv(a_dev, ALC_FREQUENCY, 1, &out_sample_rate);
+    logAudio("device frequency %d\n", out_sample_rate);
+
+    init_al_events();
+    logAudio("buffer events %s\n",
+             use_al_events ? "supported" : "not supported");
+    if (alIsExtensionPresent("AL_SOFT_source_latency")) {
+        get_source_i64v = alGetProcAddress("alGetSourcei64vSOFT");
+    }
+    logAudio("source latency %s\n",
+             get_source_i64v ? "supported" : "not supported");
 
     alGetError();
     alGenBuffers(NB_AL_BUFFER, a_buf);
     check_al_error("alGenBuffers");
+    buf_head = buf_queued = 0;
+    buf_queued_duration = 0;
 
     alGenSources(1, &a_src);
     check_al_error("alGenSources");
@@ -221,15 +665,19 @@ void init_audio_play() {
     alSourcei(a_src, AL_LOOPING, 0);  // 循环
 
     alListener3f(AL_POSITION, 0, 0, 0);
-    return;
 
-end:
-    a_dev = NULL;
+    if (audio_backend != AUDIO_BACKEND_OPENAL) {
+        start_loopback();
+    }
 }
 
-static void audio_enqueue_frame(StreamContext *ctx, const AVFrame *frame) {
-    AVFrame *s16Frame = convert_frame_to_stereo_s16(frame);
-    play_audio_frame(ctx, s16Frame);
+static void audio_enqueue_frame(PlayContext *pc, const AVFrame *frame) {
+    StreamContext *sc = pc->audio_sc;
+    AVFrame *s16Frame = convert_frame_to_stereo_s16(
+        sc, frame, get_wanted_samples(pc, frame));
+    if (s16Frame->nb_samples > 0) {
+        play_audio_frame(sc, s16Frame);
+    }
     av_frame_free(&s16Frame);
 }
 
@@ -239,11 +687,15 @@ static void onPause(StreamContext *sc) {
 
 static void onResume(StreamContext *sc) {
     alSourcePlay(a_src);
+    wake_loopback();
 }
 
 static void onSeek(StreamContext *sc) {
+    packer_reset();
     alSourceStop(a_src);
     free_buffers(sc);
+    // 丢弃重采样器中缓存的seek之前的采样
+    swr_free(&swr_ctx);
 }
 
 void *audio_play_thread(PlayContext *pc) {
@@ -256,7 +708,6 @@ void *audio_play_thread(PlayContext *pc) {
 
     logRender("[audio-play] tid=%lu\n", pthread_self());
     init_audio_play();
-    queue_init(&pts_queue);
     q = &sc->frame_queue;
 
     for (;;) {
@@ -264,10 +715,12 @@ void *audio_play_thread(PlayContext *pc) {
         if (!frame) {
             // 时间更新依赖上面的循环，如果播放到最后没数据了，
             // 需要处理下AL播放队列中剩余的内容，并更新时间
+            packer_flush(sc);
             wait_remain_buffers(sc);
+            stop_loopback();
             break;
         }
-        audio_enqueue_frame(sc, frame);
+        audio_enqueue_frame(pc, frame);
         av_frame_free(&frame);
 
         process_play_events(sc, onPause, onResume, onSeek);
@@ -5,6 +5,20 @@
 
 #include "codec.h"
 
+enum AudioBackend {
+    /** 输出到默认的音频设备 */
+    AUDIO_BACKEND_OPENAL,
+    /** 回环设备，按实际时长消费采样，不输出声音 */
+    AUDIO_BACKEND_LOOPBACK,
+    /** 回环设备，尽可能快地消费采样，用于测试吞吐量 */
+    AUDIO_BACKEND_LOOPBACK_FAST,
+};
+
+/**
+ * 设置音频输出方式，需要在音频播放线程启动之前调用
+ */
+void set_audio_backend(enum AudioBackend backend);
+
 void *audio_play_thread(PlayContext *play_ctx);
 
 #endif /* ifndef _AUDIO_H_ */
@@ -0,0 +1,135 @@
+#include "clock.h"
+
+#include <time.h>
+
+typedef struct {
+    int64_t pts, updated_at;
+    double speed;
+} ClockSnapshot;
+
+int64_t clock_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
+static void read_snapshot(Clock *c, ClockSnapshot *snapshot) {
+    unsigned int begin, end;
+    do {
+        begin = atomic_load_explicit(&c->seq, memory_order_acquire);
+        snapshot->pts = atomic_load_explicit(&c->pts, memory_order_relaxed);
+        snapshot->updated_at =
+            atomic_load_explicit(&c->updated_at, memory_order_relaxed);
+        snapshot->speed = atomic_load_explicit(&c->speed, memory_order_relaxed);
+        // 保证上面的读取在再次读取序号之前完成
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&c->seq, memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+}
+
+/**
+ * 需要持有write_lock
+ */
+static void write_snapshot(Clock *c, const ClockSnapshot *snapshot) {
+    unsigned int seq = atomic_load_explicit(&c->seq, memory_order_relaxed);
+    atomic_store_explicit(&c->seq, seq + 1, memory_order_relaxed);
+    // 保证读者看到新的字段之前先看到奇数序号
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&c->pts, snapshot->pts, memory_order_relaxed);
+    atomic_store_explicit(&c->updated_at, snapshot->updated_at,
+                          memory_order_relaxed);
+    atomic_store_explicit(&c->speed, snapshot->speed, memory_order_relaxed);
+    atomic_store_explicit(&c->seq, seq + 2, memory_order_release);
+}
+
+static int64_t extrapolate(const ClockSnapshot *snapshot, int64_t now) {
+    if (snapshot->updated_at == CLOCK_UNSET) {
+        return snapshot->pts;
+    }
+    return snapshot->pts +
+           (int64_t) ((now - snapshot->updated_at) * snapshot->speed);
+}
+
+void clock_init(Clock *c) {
+    pthread_mutex_init(&c->write_lock, NULL);
+    atomic_init(&c->seq, 0);
+    atomic_init(&c->pts, 0);
+    atomic_init(&c->updated_at, CLOCK_UNSET);
+    atomic_init(&c->speed, 1);
+}
+
+void clock_destroy(Clock *c) {
+    pthread_mutex_destroy(&c->write_lock);
+}
+
+void clock_update_at(Clock *c, int64_t pts, double speed, int64_t now) {
+    ClockSnapshot snapshot = {pts, now, speed};
+    pthread_mutex_lock(&c->write_lock);
+    write_snapshot(c, &snapshot);
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+void clock_update(Clock *c, int64_t pts, double speed) {
+    clock_update_at(c, pts, speed, clock_now());
+}
+
+void clock_set_speed(Clock *c, double speed) {
+    ClockSnapshot snapshot;
+    pthread_mutex_lock(&c->write_lock);
+    read_snapshot(c, &snapshot);
+    if (snapshot.updated_at != CLOCK_UNSET) {
+        int64_t now = clock_now();
+        snapshot.pts = extrapolate(&snapshot, now);
+        snapshot.updated_at = now;
+    }
+    snapshot.speed = speed;
+    write_snapshot(c, &snapshot);
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+void clock_invalidate(Clock *c, int64_t pts) {
+    ClockSnapshot snapshot;
+    pthread_mutex_lock(&c->write_lock);
+    read_snapshot(c, &snapshot);
+    snapshot.pts = pts;
+    snapshot.updated_at = CLOCK_UNSET;
+    write_snapshot(c, &snapshot);
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+int clock_start(Clock *c, int64_t pts) {
+    ClockSnapshot snapshot;
+    int started = 0;
+    pthread_mutex_lock(&c->write_lock);
+    read_snapshot(c, &snapshot);
+    if (snapshot.updated_at == CLOCK_UNSET) {
+        snapshot.pts = pts;
+        snapshot.updated_at = clock_now();
+        write_snapshot(c, &snapshot);
+        started = 1;
+    }
+    pthread_mutex_unlock(&c->write_lock);
+    return started;
+}
+
+int clock_is_set(Clock *c) {
+    ClockSnapshot snapshot;
+    read_snapshot(c, &snapshot);
+    return snapshot.updated_at != CLOCK_UNSET;
+}
+
+int clock_is_running(Clock *c) {
+    ClockSnapshot snapshot;
+    read_snapshot(c, &snapshot);
+    return snapshot.updated_at != CLOCK_UNSET && snapshot.speed != 0;
+}
+
+int64_t clock_get_at(Clock *c, int64_t now) {
+    ClockSnapshot snapshot;
+    read_snapshot(c, &snapshot);
+    return extrapolate(&snapshot, now);
+}
+
+int64_t clock_get(Clock *c) {
+    return clock_get_at(c, clock_now());
+}
@@ -0,0 +1,68 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * 播放时钟：发布{pts, updated_at, speed}快照，读取时按经过的时间外推出当前的
+ * 播放时间，两次更新之间读到的时间也是连续的
+ *
+ * 快照通过序号锁（seqlock）发布：写者之间用互斥锁串行，读者不加锁，读到
+ * 写了一半的快照时重试，因此播放线程更新时钟不会被读者阻塞。
+ */
+typedef struct {
+    pthread_mutex_t write_lock;
+    /** 序号，奇数表示正在写入 */
+    atomic_uint seq;
+    /** updated_at（单调时钟）时的播放时间，单位：微秒 */
+    atomic_llong pts;
+    /** 快照的时间，CLOCK_UNSET表示时钟尚未开始，不会推进 */
+    atomic_llong updated_at;
+    /** 播放速率，暂停时为0 */
+    _Atomic double speed;
+} Clock;
+
+#define CLOCK_UNSET INT64_MIN
+
+/**
+ * 单调时钟的当前时间，单位：微秒
+ */
+int64_t clock_now();
+
+/**
+ * 初始化为未开始状态，时间为0，速率为1
+ */
+void clock_init(Clock *c);
+void clock_destroy(Clock *c);
+/**
+ * 在now时设置播放时间和速率
+ */
+void clock_update_at(Clock *c, int64_t pts, double speed, int64_t now);
+void clock_update(Clock *c, int64_t pts, double speed);
+/**
+ * 从当前时间开始以新的速率推进，暂停、继续时使用
+ */
+void clock_set_speed(Clock *c, double speed);
+/**
+ * 回到未开始状态，时间停在pts
+ */
+void clock_invalidate(Clock *c, int64_t pts);
+/**
+ * 时钟未开始时，以pts为起点、保持原有速率开始推进，返回是否设置了时钟
+ */
+int clock_start(Clock *c, int64_t pts);
+int clock_is_set(Clock *c);
+/**
+ * 时钟已经开始并且速率不为0
+ */
+int clock_is_running(Clock *c);
+
+/**
+ * 外推出now时的播放时间
+ */
+int64_t clock_get_at(Clock *c, int64_t now);
+int64_t clock_get(Clock *c);
+
+#endif /* ifndef _CLOCK_H_ */
@@ -1,5 +1,7 @@
 #include "codec.h"
 
+#include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
 #include <pthread.h>
 #include <unistd.h>
 
@@ -13,22 +15,114 @@ static void dispatch_all_event(PlayContext *pc, Event *event);
 static void dispatch_demux_event(PlayContext *pc, Event *event);
 static void dispatch_decode_event(StreamContext *sc, Event *event);
 static void dispatch_decode_event_all(PlayContext *pc, Event *event);
-static void dispatch_play_event(StreamContext *sc, Event *event);
 static void dispatch_play_event_all(PlayContext *pc, Event *event);
-static void on_seek_end(PlayContext *pc);
+static void on_seek_end(PlayContext *pc, int handled);
+
+/**
+ * 队列元素较少时总是可以入队，否则按缓冲的时长和字节数限制
+ */
+static int queue_within_limits(Queue *q, int64_t max_duration,
+                               int64_t max_bytes) {
+    if (q->length < QUEUE_MIN_LENGTH) {
+        return 1;
+    }
+    return q->duration < max_duration && q->bytes < max_bytes;
+}
 
 static int packet_can_queue(Queue *q) {
-    if (q->length >= PKT_QUEUE_SIZE) {
-        /* logCodec("packet queue is full\n"); */
-    }
-    return q->length < PKT_QUEUE_SIZE;
+    return queue_within_limits(q, PKT_QUEUE_MAX_DURATION, PKT_QUEUE_MAX_BYTES);
 }
 
 static int frame_can_queue(Queue *q) {
-    if (q->length >= FRAME_QUEUE_SIZE) {
-        /* logCodec("frame queue is full\n"); */
+    return queue_within_limits(q, FRAME_QUEUE_MAX_DURATION,
+                               FRAME_QUEUE_MAX_BYTES);
+}
+
+static void measure_packet(Queue *q, const AVPacket *pkt, int64_t *bytes,
+                           int64_t *duration) {
+    if (!pkt) {
+        return;
+    }
+    StreamContext *sc = list_object(q, StreamContext, pkt_queue);
+    *bytes = pkt->size;
+    *duration = pts_to_microseconds(sc, pkt->duration);
+}
+
+static void measure_frame(Queue *q, const AVFrame *frame, int64_t *bytes,
+                          int64_t *duration) {
+    if (!frame) {
+        return;
+    }
+    StreamContext *sc = list_object(q, StreamContext, frame_queue);
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        *bytes += frame->buf[i]->size;
+    }
+    if (sc->media_type == AVMEDIA_TYPE_AUDIO && frame->sample_rate > 0) {
+        // 音频帧的时长由采样数决定，比包里的时长更可靠
+        *duration =
+            av_rescale(frame->nb_samples, 1000 * 1000, frame->sample_rate);
+    } else {
+        *duration = pts_to_microseconds(sc, frame->pkt_duration);
+    }
+}
+
+void stream_context_init(StreamContext *sc) {
+    queue_init_spsc(&sc->pkt_queue, PKT_QUEUE_SIZE);
+    queue_set_measurer(&sc->pkt_queue, (DataMeasurer) measure_packet);
+    queue_init_spsc(&sc->frame_queue, FRAME_QUEUE_SIZE);
+    queue_set_measurer(&sc->frame_queue, (DataMeasurer) measure_frame);
+    queue_init(&sc->play_event_queue);
+    queue_init(&sc->decode_event_queue);
+    clock_init(&sc->clock);
+    sc->last_frame_pts = AV_NOPTS_VALUE;
+    sc->last_frame_interval = 0;
+    atomic_init(&sc->late_frames, 0);
+    atomic_init(&sc->on_time_frames, 0);
+    sc->skip_level = 0;
+    sc->seek_target = AV_NOPTS_VALUE;
+    if (sc->media_type == AVMEDIA_TYPE_VIDEO) {
+        queue_init_spsc(&sc->convert_queue, CONVERT_QUEUE_SIZE);
+        queue_init(&sc->convert_event_queue);
     }
-    return q->length < FRAME_QUEUE_SIZE;
+}
+
+void play_context_init(PlayContext *pc) {
+    queue_init(&pc->demux_event_queue);
+    clock_init(&pc->external_clock);
+    pc->seek_pkt = NULL;
+    pthread_mutex_init(&pc->seek_lock, NULL);
+    pc->pending_seeks = 0;
+    pc->seek_to = 0;
+}
+
+void sync_external_clock(PlayContext *pc, int64_t time) {
+    clock_start(&pc->external_clock, time);
+}
+
+int64_t get_master_clock(PlayContext *pc) {
+    switch (pc->clock_master) {
+        case CLOCK_MASTER_AUDIO:
+            return clock_get(&pc->audio_sc->clock);
+        case CLOCK_MASTER_VIDEO:
+            return clock_get(&pc->video_sc->clock);
+        default:
+            return clock_get(&pc->external_clock);
+    }
+}
+
+/**
+ * 各selector中事件队列和数据队列的序号，事件队列优先
+ */
+enum {
+    SELECT_EVENT,
+    SELECT_DATA,
+};
+
+static void init_selector(Selector *sel, Queue *event_queue, Queue *data_queue,
+                          QueuePrediction pred, enum QueueWaitFor wait_for) {
+    selector_init(sel);
+    selector_add(sel, event_queue, queue_has_data, QUEUE_WAIT_DEQUEUE);
+    selector_add(sel, data_queue, pred, wait_for);
 }
 
 static void free_frame(AVFrame *frame) {
@@ -39,15 +133,85 @@ static void free_packet(AVPacket *pkt) {
     av_packet_free(&pkt);
 }
 
-static void do_seek(AVFormatContext *fc, StreamContext *sc,
-                    int64_t to_microseconds) {
-    if (sc) {
-        av_seek_frame(fc, sc->stream->index,
-                      microseconds_to_pts(sc, to_microseconds), 0);
-        sc->play_time = to_microseconds;
-        avcodec_flush_buffers(sc->cc);
-        queue_clear(&sc->pkt_queue, (DataCleaner) free_packet);
+static StreamContext *get_stream_context_for_packet(PlayContext *ctx,
+                                                    const AVPacket *pkt) {
+    if (ctx->video_sc && pkt->stream_index == ctx->video_sc->stream->index) {
+        return ctx->video_sc;
+    }
+    if (ctx->audio_sc && pkt->stream_index == ctx->audio_sc->stream->index) {
+        return ctx->audio_sc;
+    }
+    return NULL;
+}
+
+/**
+ * 对整个文件执行一次seek（时间戳为AV_TIME_BASE，即微秒），并清空包队列。
+ * 与ffplay一样用from限制落点的范围：向前seek不会落在当前位置之前，
+ * 向后seek不会落在当前位置之后；范围内由解封装器吸附到关键帧。
+ * 精确seek时落点必须不晚于目标位置，之后由解码线程向前丢弃到目标位置。
+ *
+ * 返回实际落点：读出seek之后的第一个包，用它的时间作为落点，这个包留给
+ * 解封装线程下一次入队
+ */
+static int64_t seek_file(PlayContext *pc, int64_t from, int64_t to,
+                         int accurate) {
+    int ret;
+    int64_t min = to > from ? from + 2 : INT64_MIN;
+    int64_t max = to < from ? from - 2 : INT64_MAX;
+    if (accurate) {
+        min = INT64_MIN;
+        max = to;
+    }
+
+    if ((ret = avformat_seek_file(pc->fc, -1, min, to, max, 0)) < 0) {
+        logCodecE("[demux] seek to %ld failed: %s\n", to, av_err2str(ret));
+    }
+    StreamContext *scs[] = {pc->video_sc, pc->audio_sc};
+    for (int i = 0; i < 2; i++) {
+        if (scs[i]) {
+            queue_clear(&scs[i]->pkt_queue, (DataCleaner) free_packet);
+        }
+    }
+
+    av_packet_free(&pc->seek_pkt);
+    for (;;) {
+        AVPacket *pkt = av_packet_alloc();
+        if (!pkt) {
+            averror(AVERROR_UNKNOWN, "alloc packet");
+        }
+        if (av_read_frame(pc->fc, pkt) != 0) {
+            // 读取失败（如到达末尾）时由解封装线程之后再处理
+            av_packet_free(&pkt);
+            return to;
+        }
+        StreamContext *sc = get_stream_context_for_packet(pc, pkt);
+        if (!sc) {
+            av_packet_free(&pkt);
+            continue;
+        }
+        pc->seek_pkt = pkt;
+        int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        return ts != AV_NOPTS_VALUE ? pts_to_microseconds(sc, ts) : to;
+    }
+}
+
+/**
+ * 取出事件队列中排队的seek请求，替换掉当前的seek，只保留最新的一个；
+ * 解封装线程不处理其他事件，直接丢弃。返回合并掉的seek个数
+ */
+static int take_newer_seeks(PlayContext *pc, Event **seek) {
+    int n = 0;
+    Event *event;
+    while ((event = queue_dequeue(&pc->demux_event_queue))) {
+        if (event->type == EVENT_SEEK_START) {
+            event_unref(*seek);
+            *seek = event;
+            n++;
+        } else {
+            event_unref(event);
+        }
     }
+    return n;
 }
 
 static void process_demux_event(PlayContext *pc) {
@@ -60,22 +224,45 @@ static void process_demux_event(PlayContext *pc) {
         logRender("[event-demux] get type %d\n", event->type);
         switch (event->type) {
             case EVENT_SEEK_START: {
-                SeekEvent *seek_start = (SeekEvent *) event;
-                int64_t to_microseconds = seek_start->to_microseconds;
-
-                // 先广播到解码和播放线程
+                // 先广播到解码、转换和播放线程，它们清空队列之后等待SEEK_END
                 dispatch_decode_event_all(pc, event);
+                if (pc->video_sc) {
+                    dispatch_convert_event(pc->video_sc, event);
+                }
                 dispatch_play_event_all(pc, event);
 
-                do_seek(pc->fc, pc->audio_sc, to_microseconds);
-                do_seek(pc->fc, pc->video_sc, to_microseconds);
+                // 快速连续的seek只执行最新的一个；seek之后、通知解码之前又有
+                // 新的seek时，直接重新seek，下游线程只经历一次清空和恢复。
+                // 方向的限制以第一个seek发起时的播放位置为准
+                int64_t from = ((SeekEvent *) event)->from_microseconds;
+                int handled = 1 + take_newer_seeks(pc, &event);
+                SeekEvent *seek_start = (SeekEvent *) event;
+                int64_t landed;
+                for (;;) {
+                    landed = seek_file(pc, from, seek_start->to_microseconds,
+                                       seek_start->accurate);
+                    int n = take_newer_seeks(pc, &event);
+                    if (n == 0) {
+                        break;
+                    }
+                    handled += n;
+                    seek_start = (SeekEvent *) event;
+                }
+                logCodec("[demux] seek from %ld to %ld, landed at %ld, "
+                         "%d request(s) coalesced\n",
+                         from, seek_start->to_microseconds, landed, handled);
 
                 Event *seek_end =
                     event_alloc(EVENT_SEEK_END, sizeof(SeekEvent));
-                ((SeekEvent *) seek_end)->to_microseconds = to_microseconds;
+                // 精确seek时各线程以目标位置为准，落点到目标位置之间的帧
+                // 由解码线程丢弃
+                ((SeekEvent *) seek_end)->to_microseconds =
+                    seek_start->accurate ? seek_start->to_microseconds : landed;
+                ((SeekEvent *) seek_end)->from_microseconds = from;
+                ((SeekEvent *) seek_end)->accurate = seek_start->accurate;
                 dispatch_decode_event_all(pc, seek_end);
                 event_unref(seek_end);
-                on_seek_end(pc);
+                on_seek_end(pc, handled);
             } break;
             default:
                 break;
@@ -84,17 +271,6 @@ static void process_demux_event(PlayContext *pc) {
     }
 }
 
-static StreamContext *get_stream_context_for_packet(PlayContext *ctx,
-                                                    const AVPacket *pkt) {
-    if (ctx->video_sc && pkt->stream_index == ctx->video_sc->stream->index) {
-        return ctx->video_sc;
-    }
-    if (ctx->audio_sc && pkt->stream_index == ctx->audio_sc->stream->index) {
-        return ctx->audio_sc;
-    }
-    return NULL;
-}
-
 static void draining(PlayContext *ctx) {
     // draining mode
     logCodec("enter draining mode\n");
@@ -119,14 +295,22 @@ static void enqueue_packet(PlayContext *ctx, AVPacket *pkt) {
                   pkt->stream_index, av_get_media_type_string(pkt_type));
         return;
     }
-    while (!queue_enqueue_timedwait(&play_ctx->pkt_queue, pkt, packet_can_queue,
-                                    QUEUE_WAIT_MICROSECONDS)) {
+    // 等待包队列可入队，期间处理解封装事件；如果期间发生了seek，
+    // 包队列的代数会变化，这个seek之前读出的包会被丢弃
+    unsigned int epoch = queue_epoch(&play_ctx->pkt_queue);
+    while (selector_wait(&play_ctx->demux_selector, -1) == SELECT_EVENT) {
         process_demux_event(ctx);
     }
+    if (!queue_enqueue_tagged(&play_ctx->pkt_queue, pkt, epoch,
+                              (DataCleaner) free_packet)) {
+        logCodec("dropped stale packet: type=%s\n",
+                 av_get_media_type_string(play_ctx->cc->codec_type));
+    } else {
+        logCodec("enqueued packet: type=%s, queue_size=%d\n",
+                 av_get_media_type_string(play_ctx->cc->codec_type),
+                 play_ctx->pkt_queue.length);
+    }
     process_demux_event(ctx);
-    logCodec("enqueued packet: type=%s, queue_size=%d\n",
-             av_get_media_type_string(play_ctx->cc->codec_type),
-             play_ctx->pkt_queue.length);
 }
 
 void *demux_thread(PlayContext *pc) {
@@ -136,17 +320,32 @@ void *demux_thread(PlayContext *pc) {
     // 编解码的api参考 https://ffmpeg.org/doxygen/trunk/group__lavc__encdec.html
     int pkt_eof = 0;
     int i = 0;
-    for (; !pkt_eof; i++) {
-        // avcodec 分配一个packet
-        // packet中包含一个或多个有效帧
-        if ((pkt = av_packet_alloc()) == NULL) {
-            averror(AVERROR_UNKNOWN, "alloc packet");
+    StreamContext *scs[] = {pc->video_sc, pc->audio_sc};
+    for (int n = 0; n < 2; n++) {
+        if (scs[n]) {
+            init_selector(&scs[n]->demux_selector, &pc->demux_event_queue,
+                          &scs[n]->pkt_queue, packet_can_queue,
+                          QUEUE_WAIT_ENQUEUE);
         }
+    }
+    for (; !pkt_eof; i++) {
+        if (pc->seek_pkt) {
+            // seek时为了得到落点已经读出的包
+            pkt = pc->seek_pkt;
+            pc->seek_pkt = NULL;
+            ret = 0;
+        } else {
+            // avcodec 分配一个packet
+            // packet中包含一个或多个有效帧
+            if ((pkt = av_packet_alloc()) == NULL) {
+                averror(AVERROR_UNKNOWN, "alloc packet");
+            }
 
-        // avformat 读取一个packet，其中至少有一个完整的frame
-        // @see
-        // http://ffmpeg.org/doxygen/trunk/group__lavf__decoding.html#details
-        ret = av_read_frame(pc->fc, pkt);
+            // avformat 读取一个packet，其中至少有一个完整的frame
+            // @see
+            // http://ffmpeg.org/doxygen/trunk/group__lavf__decoding.html#details
+            ret = av_read_frame(pc->fc, pkt);
+        }
         if (ret) {
             if (ret == AVERROR_EOF) {
                 pkt_eof = 1;
@@ -177,10 +376,26 @@ static void process_decode_event(PlayContext *pc, StreamContext *sc) {
             case EVENT_SEEK_START: {
                 logCodec("[event-decode] waiting for SEEK_END\n");
                 queue_clear(&sc->frame_queue, (DataCleaner) free_frame);
+                sc->last_frame_pts = AV_NOPTS_VALUE;
+                sc->last_frame_interval = 0;
+                atomic_store(&sc->late_frames, 0);
+                atomic_store(&sc->on_time_frames, 0);
+                sc->seek_target = AV_NOPTS_VALUE;
                 dump_queue_info(pc);
                 Event *seek_end =
                     wait_for_event(&sc->decode_event_queue, EVENT_SEEK_END);
-                dispatch_play_event(sc, seek_end);
+                // 解码器只由解码线程访问，在这里清空解码器内部缓存的帧
+                avcodec_flush_buffers(sc->cc);
+                if (((SeekEvent *) seek_end)->accurate) {
+                    sc->seek_target = ((SeekEvent *) seek_end)->to_microseconds;
+                }
+                // 帧队列清空之后，再通知下一个阶段；视频流的下一个阶段是转换线程，
+                // 由转换线程清空转换队列之后再通知播放线程
+                if (sc->media_type == AVMEDIA_TYPE_VIDEO) {
+                    dispatch_convert_event(sc, seek_end);
+                } else {
+                    dispatch_play_event(sc, seek_end);
+                }
                 event_unref(seek_end);
             } break;
             default:
@@ -190,23 +405,172 @@ static void process_decode_event(PlayContext *pc, StreamContext *sc) {
     }
 }
 
+/**
+ * 按采样数计算音频帧的时长；视频没有帧间隔可以参考时，按流的帧率估计
+ */
+static int64_t guess_frame_duration(const StreamContext *sc,
+                                    const AVFrame *frame) {
+    AVStream *st = sc->stream;
+    if (sc->media_type == AVMEDIA_TYPE_AUDIO && frame->sample_rate > 0) {
+        return av_rescale_q(frame->nb_samples,
+                            (AVRational){1, frame->sample_rate},
+                            st->time_base);
+    }
+    AVRational rate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate
+                                                 : st->r_frame_rate;
+    if (rate.num > 0 && rate.den > 0) {
+        return av_rescale_q(1, av_inv_q(rate), st->time_base);
+    }
+    return 0;
+}
+
+/**
+ * 补全帧的时间信息，之后的阶段只使用frame->pts和frame->pkt_duration：
+ *
+ * - pts使用best_effort_timestamp，都没有时按上一帧推算；
+ * - 可变帧率（VFR）的流中每帧的时长可能不同，优先使用帧自带的时长，
+ *   没有时使用最近一次观察到的帧间隔，再没有才按帧率估计；
+ * - 音频帧没有自带时长时，直接按采样数计算，这是精确的时长。
+ */
+static void fix_frame_timing(StreamContext *sc, AVFrame *frame) {
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+        frame->pts = frame->best_effort_timestamp;
+    }
+    if (sc->last_frame_pts != AV_NOPTS_VALUE) {
+        if (frame->pts == AV_NOPTS_VALUE) {
+            frame->pts = sc->last_frame_pts + sc->last_frame_interval;
+        } else if (frame->pts > sc->last_frame_pts) {
+            sc->last_frame_interval = frame->pts - sc->last_frame_pts;
+        }
+    }
+    if (frame->pkt_duration <= 0) {
+        if (sc->media_type == AVMEDIA_TYPE_VIDEO &&
+            sc->last_frame_interval > 0) {
+            frame->pkt_duration = sc->last_frame_interval;
+        } else {
+            frame->pkt_duration = guess_frame_duration(sc, frame);
+        }
+    }
+    if (frame->pts != AV_NOPTS_VALUE) {
+        sc->last_frame_pts = frame->pts;
+    }
+}
+
+/**
+ * 视频持续落后时，让解码器跳过非参考帧及其环路滤波，减少解码工作量，
+ * 仍然落后时进一步只解码关键帧；跳过的非参考帧不影响后续帧的解码，
+ * 参考帧的环路滤波始终保留，避免瑕疵扩散到后续帧。
+ *
+ * 连续按时DECODE_SKIP_RECOVER_FRAMES帧之后才降低一级，避免负载稳定在
+ * 临界值附近时逐帧来回切换
+ */
+static void update_decode_skip(StreamContext *sc) {
+    static const enum AVDiscard skip_frame[] = {
+        AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_NONKEY};
+    int late_frames = atomic_load(&sc->late_frames);
+    int level = sc->skip_level;
+
+    if (late_frames >= DECODE_SKIP_NONKEY_LATE_FRAMES) {
+        level = 2;
+    } else if (late_frames >= DECODE_SKIP_LATE_FRAMES && level == 0) {
+        level = 1;
+    } else if (level > 0 && atomic_load(&sc->on_time_frames) >=
+                                DECODE_SKIP_RECOVER_FRAMES) {
+        level--;
+        // 每降低一级都需要重新连续按时
+        atomic_store(&sc->on_time_frames, 0);
+    }
+    if (level == sc->skip_level) {
+        return;
+    }
+    sc->cc->skip_frame = skip_frame[level];
+    sc->cc->skip_loop_filter =
+        level > 0 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    logCodec("[video-decode] skip level %d -> %d, late_frames=%d\n",
+             sc->skip_level, level, late_frames);
+    sc->skip_level = level;
+}
+
+/**
+ * 丢掉音频帧开头的samples个采样，只调整数据指针，不复制数据
+ */
+static void trim_audio_frame(StreamContext *sc, AVFrame *frame, int samples) {
+    int channels = frame->ch_layout.nb_channels;
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int planes = planar ? channels : 1;
+    int offset = samples * av_get_bytes_per_sample(frame->format) *
+                 (planar ? 1 : channels);
+    for (int i = 0; i < planes; i++) {
+        frame->extended_data[i] += offset;
+    }
+    if (frame->extended_data != frame->data) {
+        for (int i = 0; i < FFMIN(planes, AV_NUM_DATA_POINTERS); i++) {
+            frame->data[i] = frame->extended_data[i];
+        }
+    }
+    frame->nb_samples -= samples;
+    AVRational sample_tb = {1, frame->sample_rate};
+    frame->pts += av_rescale_q(samples, sample_tb, sc->stream->time_base);
+    // 时长按剩余的采样数重新计算，队列时长限制和音频打包都依赖它
+    frame->pkt_duration =
+        av_rescale_q(frame->nb_samples, sample_tb, sc->stream->time_base);
+}
+
+/**
+ * 精确seek时，帧是否在目标位置之前、需要直接丢弃（不转换、不入队）。
+ * 视频保留包含目标位置的帧；音频把跨过目标位置的帧裁剪到对应的采样
+ */
+static int is_before_seek_target(StreamContext *sc, AVFrame *frame) {
+    int64_t target = sc->seek_target;
+    if (target == AV_NOPTS_VALUE || frame->pts == AV_NOPTS_VALUE) {
+        return 0;
+    }
+    int64_t start = pts_to_microseconds(sc, frame->pts);
+    if (sc->media_type == AVMEDIA_TYPE_AUDIO) {
+        int64_t skip =
+            av_rescale(target - start, frame->sample_rate, 1000 * 1000);
+        if (skip >= frame->nb_samples) {
+            return 1;
+        }
+        if (skip > 0) {
+            trim_audio_frame(sc, frame, (int) skip);
+        }
+    } else if (start + pts_to_microseconds(sc, frame->pkt_duration) <=
+               target) {
+        return 1;
+    }
+    logCodec("[decode] reached seek target %ld, type=%s\n", target,
+             av_get_media_type_string(sc->media_type));
+    sc->seek_target = AV_NOPTS_VALUE;
+    return 0;
+}
+
 static void decode_packet(PlayContext *pc, StreamContext *sc,
                           const AVPacket *pkt) {
     int ret;
     AVFrame *frame;
     AVCodecContext *cc = sc->cc;
     int draining = pkt == NULL;
+    // 这个包解出的帧都属于当前代，期间发生seek之后，剩余的帧都会被丢弃
+    unsigned int epoch = queue_epoch(&sc->frame_queue);
 
+    if (sc->media_type == AVMEDIA_TYPE_VIDEO) {
+        update_decode_skip(sc);
+    }
+    int64_t begin = av_gettime_relative();
     if ((ret = avcodec_send_packet(cc, pkt)) != 0) {
         averror(ret, "send packet");
     }
+    sc->stat_busy += av_gettime_relative() - begin;
 
     for (int n_frame = 0;; n_frame++) {
         if ((frame = av_frame_alloc()) == NULL) {
             averror(AVERROR_UNKNOWN, "alloc frame");
         }
 
+        begin = av_gettime_relative();
         ret = avcodec_receive_frame(cc, frame);
+        sc->stat_busy += av_gettime_relative() - begin;
         int done = 0;
         if (ret == AVERROR(EAGAIN)) {
             if (draining) {
@@ -220,18 +584,30 @@ static void decode_packet(PlayContext *pc, StreamContext *sc,
         }
 
         if (frame->format >= 0) {
-            // TODO 数据包和事件一起处理，保持事件模型的简单
-            while (!queue_enqueue_timedwait(&sc->frame_queue, frame,
-                                            frame_can_queue,
-                                            QUEUE_WAIT_MICROSECONDS)) {
-                // 这里有个问题，如果在这个process函数里面发生了seek，seek会将包队列清空，
-                // 但是由于这是在enqueue的等待循环中，上面的while又会立即传入一个seek之前的帧，
-                // 导致SEEKING状态和包不匹配，进而导致音画同步的时间判断有问题
-                process_decode_event(pc, sc);
+            sc->stat_frames++;
+            fix_frame_timing(sc, frame);
+            if (is_before_seek_target(sc, frame)) {
+                // 精确seek时目标位置之前的帧只解码，不入队
+                av_frame_free(&frame);
+            } else {
+                while (selector_wait(&sc->decode_out_selector, -1) ==
+                       SELECT_EVENT) {
+                    // 如果在这里发生了seek，帧队列会被清空并更新代数，这个
+                    // seek之前解出的帧在下面入队时会被丢弃，避免影响音画同步
+                    process_decode_event(pc, sc);
+                }
+                int64_t pts = frame->pts;
+                if (queue_enqueue_tagged(&sc->frame_queue, frame, epoch,
+                                         (DataCleaner) free_frame)) {
+                    logCodec("enqueued new frame: pts=%ld, type=%s, "
+                             "queue_size=%d\n",
+                             pts, av_get_media_type_string(cc->codec_type),
+                             sc->frame_queue.length);
+                } else {
+                    logCodec("dropped stale frame: pts=%ld, type=%s\n", pts,
+                             av_get_media_type_string(cc->codec_type));
+                }
             }
-            logCodec("enqueued new frame: pts=%ld, type=%s, queue_size=%d\n",
-                     frame->pts, av_get_media_type_string(cc->codec_type),
-                     sc->frame_queue.length);
         }
 
         if (done) {
@@ -245,6 +621,30 @@ static void decode_packet(PlayContext *pc, StreamContext *sc,
     process_decode_event(pc, sc);
 }
 
+/**
+ * 每个统计周期输出一次解码速率，包括按实际时间计算的速率，
+ * 以及只按解码耗时计算的速率（即解码器能达到的速率）
+ */
+static void report_decode_stat(StreamContext *sc, const char *media_type_str) {
+    int64_t now = av_gettime_relative();
+    int64_t elapsed = now - sc->stat_start;
+    if (elapsed < DECODE_STAT_INTERVAL) {
+        return;
+    }
+    logCodec(
+        "[%s-decode] fps=%.1f, decoder_fps=%.1f, threads=%d, "
+        "thread_type=%s\n",
+        media_type_str, sc->stat_frames * 1e6 / elapsed,
+        sc->stat_busy > 0 ? sc->stat_frames * 1e6 / sc->stat_busy : 0.0,
+        sc->cc->thread_count,
+        sc->cc->active_thread_type == FF_THREAD_FRAME   ? "frame"
+        : sc->cc->active_thread_type == FF_THREAD_SLICE ? "slice"
+                                                        : "none");
+    sc->stat_start = now;
+    sc->stat_frames = 0;
+    sc->stat_busy = 0;
+}
+
 static void decode_thread(PlayContext *pc, enum AVMediaType to_decode) {
     AVPacket *pkt;
     Queue *q;
@@ -260,12 +660,21 @@ static void decode_thread(PlayContext *pc, enum AVMediaType to_decode) {
     }
     media_type_str = av_get_media_type_string(to_decode);
     q = &sc->pkt_queue;
+    init_selector(&sc->decode_in_selector, &sc->decode_event_queue, q,
+                  queue_has_data, QUEUE_WAIT_DEQUEUE);
+    init_selector(&sc->decode_out_selector, &sc->decode_event_queue,
+                  &sc->frame_queue, frame_can_queue, QUEUE_WAIT_ENQUEUE);
+    sc->stat_start = av_gettime_relative();
 
     for (;;) {
-        while (!queue_dequeue_timedwait(
-            q, queue_has_data, QUEUE_WAIT_MICROSECONDS, (void **) &pkt)) {
-            process_decode_event(pc, sc);
-        }
+        // 等待包队列有数据，期间处理解码事件；唤醒之后、出队之前队列可能
+        // 已经被seek清空，这时重新等待，只有取到空packet才表示流结束
+        do {
+            while (selector_wait(&sc->decode_in_selector, -1) ==
+                   SELECT_EVENT) {
+                process_decode_event(pc, sc);
+            }
+        } while (!queue_try_dequeue(q, (void **) &pkt));
         if (!pkt) {
             // 收到空packet之后，进入draining模式，让解码器输出缓存的帧
             logCodec("[%s-decode] got null packet\n", media_type_str);
@@ -275,6 +684,7 @@ static void decode_thread(PlayContext *pc, enum AVMediaType to_decode) {
         }
 
         decode_packet(pc, sc, pkt);
+        report_decode_stat(sc, media_type_str);
         if (!pkt) {
             break;
         } else {
@@ -334,11 +744,16 @@ static void dispatch_decode_event_all(PlayContext *pc, Event *event) {
     }
 }
 
-static void dispatch_play_event(StreamContext *sc, Event *event) {
+void dispatch_play_event(StreamContext *sc, Event *event) {
     logCodec("[event] dispatch_play_event: type=%d\n", event->type);
     put_event(&sc->play_event_queue, event);
 }
 
+void dispatch_convert_event(StreamContext *sc, Event *event) {
+    logCodec("[event] dispatch_convert_event: type=%d\n", event->type);
+    put_event(&sc->convert_event_queue, event);
+}
+
 static void dispatch_play_event_all(PlayContext *pc, Event *event) {
     logCodec("[event] dispatch_play_event_all: type=%d\n, video=%d, audio=%d",
              event->type, !!pc->video_sc, !!pc->audio_sc);
@@ -353,6 +768,7 @@ static void dispatch_play_event_all(PlayContext *pc, Event *event) {
 int play_pause(PlayContext *pc) {
     if (pc->state == STATE_PLAYING) {
         pc->state = STATE_PAUSE;
+        clock_set_speed(&pc->external_clock, 0);
         Event *ev = event_alloc_base(EVENT_PAUSE);
         dispatch_all_event(pc, ev);
         event_unref(ev);
@@ -364,6 +780,7 @@ int play_pause(PlayContext *pc) {
 int play_resume(PlayContext *pc) {
     if (pc->state == STATE_PAUSE) {
         pc->state = STATE_PLAYING;
+        clock_set_speed(&pc->external_clock, 1);
         Event *ev = event_alloc_base(EVENT_RESUME);
         dispatch_all_event(pc, ev);
         event_unref(ev);
@@ -381,30 +798,60 @@ int play_toggle(PlayContext *pc) {
     return 0;
 }
 
-static void on_seek_end(PlayContext *pc) {
+/**
+ * 解封装线程处理完handled个seek请求，没有剩余的请求时退出seek状态
+ */
+static void on_seek_end(PlayContext *pc, int handled) {
     logCodec("[seek] on_seek_end\n");
-    if (pc->state == STATE_PLAY_SEEKING) {
-        pc->state = STATE_PLAYING;
-    } else if (pc->state == STATE_PAUSE_SEEKING) {
-        pc->state = STATE_PAUSE;
-    } else {
-        error("not seeking");
+    pthread_mutex_lock(&pc->seek_lock);
+    pc->pending_seeks -= handled;
+    if (pc->pending_seeks == 0) {
+        if (pc->state == STATE_PLAY_SEEKING) {
+            pc->state = STATE_PLAYING;
+        } else if (pc->state == STATE_PAUSE_SEEKING) {
+            pc->state = STATE_PAUSE;
+        } else {
+            error("not seeking");
+        }
     }
+    pthread_mutex_unlock(&pc->seek_lock);
     dump_queue_info(pc);
 }
 
-int play_seek(PlayContext *pc, int64_t to_microseconds) {
+/**
+ * 发起seek；正在seek时也可以发起新的seek，由解封装线程合并，只执行最新的
+ */
+int play_seek(PlayContext *pc, int64_t to_microseconds, int accurate) {
     logCodec("[demux] seek triggered\n");
+    pthread_mutex_lock(&pc->seek_lock);
     if (pc->state == STATE_PLAYING) {
         pc->state = STATE_PLAY_SEEKING;
     } else if (pc->state == STATE_PAUSE) {
         pc->state = STATE_PAUSE_SEEKING;
-    } else {
-        return 0;
     }
+    pc->pending_seeks++;
+    pc->seek_to = to_microseconds;
+    // seek之后由第一个播放的帧重新设置起点
+    clock_invalidate(&pc->external_clock, to_microseconds);
     Event *ev = event_alloc(EVENT_SEEK_START, sizeof(SeekEvent));
     ((SeekEvent *) ev)->to_microseconds = to_microseconds;
+    ((SeekEvent *) ev)->from_microseconds = get_master_clock(pc);
+    ((SeekEvent *) ev)->accurate = accurate;
     dispatch_demux_event(pc, ev);
     event_unref(ev);
+    pthread_mutex_unlock(&pc->seek_lock);
     return 1;
 }
+
+/**
+ * 相对当前位置seek；正在seek时以最新的seek目标为基准，
+ * 连续的seek（如按住方向键）可以累加，而不是每次都从播放位置重新计算
+ */
+int play_seek_by(PlayContext *pc, int64_t offset_microseconds, int accurate) {
+    pthread_mutex_lock(&pc->seek_lock);
+    int64_t base = pc->pending_seeks ? pc->seek_to : get_master_clock(pc);
+    pthread_mutex_unlock(&pc->seek_lock);
+    int64_t start = pc->fc->start_time != AV_NOPTS_VALUE ? pc->fc->start_time
+                                                         : 0;
+    return play_seek(pc, FFMAX(base + offset_microseconds, start), accurate);
+}
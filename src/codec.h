@@ -5,9 +5,13 @@
 #include <libavcodec/packet.h>
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+#include "clock.h"
 #include "event.h"
 #include "queue.h"
+#include "selector.h"
 
 enum PlayState {
     STATE_PLAYING,
@@ -16,13 +20,35 @@ enum PlayState {
     STATE_PAUSE_SEEKING,
 };
 
+/**
+ * 音画同步所依据的主时钟
+ */
+enum ClockMaster {
+    /** 以音频播放时间为准，视频追赶音频 */
+    CLOCK_MASTER_AUDIO,
+    /** 以视频播放时间为准，音频通过重采样追赶视频 */
+    CLOCK_MASTER_VIDEO,
+    /** 以系统单调时钟为准，音视频都追赶外部时钟 */
+    CLOCK_MASTER_EXTERNAL,
+};
+
+/**
+ * 解码器的多线程配置，需要在打开解码器之前设置
+ */
+typedef struct {
+    /** 解码线程数，0表示根据CPU核数自动选择 */
+    int thread_count;
+    /** FF_THREAD_FRAME和FF_THREAD_SLICE的组合，表示允许使用的多线程方式 */
+    int thread_type;
+} DecodeOptions;
+
 typedef struct {
     enum AVMediaType media_type;
     Queue pkt_queue, frame_queue;
     AVCodecContext *cc;
     AVStream *stream;
-    /** 当前播放位置，单位：微秒 */
-    int64_t play_time;
+    /** 当前播放位置，由播放线程更新，其他线程可以随时读取 */
+    Clock clock;
     /**
      * 播放线程事件队列，音视频播放线程消费
      *
@@ -34,6 +60,49 @@ typedef struct {
      * 解码线程事件队列，解码线程消费
      */
     Queue decode_event_queue;
+    /**
+     * 转换阶段（仅视频流）：转换线程从frame_queue中取出帧，转换为可以渲染的格式
+     * 之后放入convert_queue，再由播放线程消费，播放线程只负责计时和提交
+     */
+    Queue convert_queue;
+    /**
+     * 转换线程事件队列，转换线程消费
+     */
+    Queue convert_event_queue;
+    /**
+     * 解封装线程等待包队列可入队或解封装事件
+     */
+    Selector demux_selector;
+    /**
+     * 解码线程等待包队列有数据或解码事件
+     */
+    Selector decode_in_selector;
+    /**
+     * 解码线程等待帧队列可入队或解码事件
+     */
+    Selector decode_out_selector;
+    /**
+     * 解码统计：统计周期的开始时间、周期内解出的帧数，以及解码实际耗时
+     * （不含等待队列的时间），单位：微秒
+     */
+    int64_t stat_start, stat_frames, stat_busy;
+    /**
+     * 帧时长估计：上一帧的pts和最近一次观察到的帧间隔，用于补全没有时长或
+     * 时间戳的帧，单位：流的time_base
+     */
+    int64_t last_frame_pts, last_frame_interval;
+    /**
+     * 连续落后主时钟和连续按时的帧数（仅视频流），由转换线程和播放线程更新，
+     * 解码线程据此决定是否跳过部分解码工作
+     */
+    atomic_int late_frames, on_time_frames;
+    /** 解码线程当前跳过的级别：0不跳过，1跳过非参考帧，2只解码关键帧 */
+    int skip_level;
+    /**
+     * 精确seek的目标位置，解码线程丢弃在这之前的帧，到达之后置为
+     * AV_NOPTS_VALUE，单位：微秒
+     */
+    int64_t seek_target;
 } StreamContext;
 
 typedef struct {
@@ -45,16 +114,68 @@ typedef struct {
      * 解封装线程事件队列，解封装线程消费
      */
     Queue demux_event_queue;
+    enum ClockMaster clock_master;
+    /**
+     * 外部时钟：按系统时间推进，暂停时停止推进。启动和seek之后处于未开始
+     * 状态，由第一个播放的音频或视频设置起点
+     */
+    Clock external_clock;
+    /**
+     * seek之后为了得到实际落点而提前读出的包，解封装线程下一次直接使用，
+     * 只有解封装线程访问
+     */
+    AVPacket *seek_pkt;
+    /**
+     * 已经发出、还没有被解封装线程处理完的seek请求个数，以及最新的seek目标，
+     * 由seek_lock保护；全部处理完之后才退出seek状态
+     */
+    pthread_mutex_t seek_lock;
+    int pending_seeks;
+    int64_t seek_to;
 } PlayContext;
 
+/**
+ * 播放阶段报告一帧是否落后于主时钟
+ */
+static inline void report_frame_lateness(StreamContext *sc, int late) {
+    atomic_int *count = late ? &sc->late_frames : &sc->on_time_frames;
+    atomic_int *reset = late ? &sc->on_time_frames : &sc->late_frames;
+    atomic_fetch_add(count, 1);
+    if (atomic_load_explicit(reset, memory_order_relaxed)) {
+        atomic_store(reset, 0);
+    }
+}
+
+/**
+ * 初始化StreamContext中的各个队列
+ */
+void stream_context_init(StreamContext *sc);
+/**
+ * 初始化PlayContext中的事件队列和外部时钟
+ */
+void play_context_init(PlayContext *pc);
+
+/**
+ * 获取主时钟的当前时间，单位：微秒
+ */
+int64_t get_master_clock(PlayContext *pc);
+/**
+ * 外部时钟尚未开始时，以time作为起点开始计时
+ */
+void sync_external_clock(PlayContext *pc, int64_t time);
+
 void *demux_thread(PlayContext *ctx);
 void *decode_audio_thread(PlayContext *pc);
 void *decode_video_thread(PlayContext *pc);
 
+void dispatch_play_event(StreamContext *sc, Event *event);
+void dispatch_convert_event(StreamContext *sc, Event *event);
+
 int play_pause(PlayContext *pc);
 int play_resume(PlayContext *pc);
 int play_toggle(PlayContext *pc);
-int play_seek(PlayContext *pc, int64_t to_microseconds);
+int play_seek(PlayContext *pc, int64_t to_microseconds, int accurate);
+int play_seek_by(PlayContext *pc, int64_t offset_microseconds, int accurate);
 
 static int64_t pts_to_microseconds(const StreamContext *sc, int64_t pts) {
     AVRational time_base =
@@ -70,11 +191,17 @@ static int64_t microseconds_to_pts(const StreamContext *sc,
 }
 
 static void dump_queue_info(const PlayContext *pc) {
-    logCodec("[queue-info] v_pkt=%d, v_frame=%d, a_pkt=%d, a_frame=%d\n",
-             pc->video_sc ? pc->video_sc->pkt_queue.length : -1,
-             pc->video_sc ? pc->video_sc->frame_queue.length : -1,
-             pc->audio_sc ? pc->audio_sc->pkt_queue.length : -1,
-             pc->audio_sc ? pc->audio_sc->frame_queue.length : -1);
+    logCodec(
+        "[queue-info] v_pkt=%d(%lldms), v_frame=%d(%lldms), "
+        "a_pkt=%d(%lldms), a_frame=%d(%lldms)\n",
+        pc->video_sc ? pc->video_sc->pkt_queue.length : -1,
+        pc->video_sc ? pc->video_sc->pkt_queue.duration / 1000 : -1,
+        pc->video_sc ? pc->video_sc->frame_queue.length : -1,
+        pc->video_sc ? pc->video_sc->frame_queue.duration / 1000 : -1,
+        pc->audio_sc ? pc->audio_sc->pkt_queue.length : -1,
+        pc->audio_sc ? pc->audio_sc->pkt_queue.duration / 1000 : -1,
+        pc->audio_sc ? pc->audio_sc->frame_queue.length : -1,
+        pc->audio_sc ? pc->audio_sc->frame_queue.duration / 1000 : -1);
 }
 
 #endif
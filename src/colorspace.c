@@ -0,0 +1,25 @@
+#include "colorspace.h"
+
+void colorspace_yuv_to_rgb(double kr, double kb, int full_range,
+                           float matrix[9], float offset[3]) {
+    double kg = 1 - kr - kb;
+    // 有限范围需要先把亮度、色度拉伸到完整的范围
+    double y_scale = full_range ? 1 : 255.0 / 219;
+    double c_scale = full_range ? 1 : 255.0 / 224;
+
+    offset[0] = full_range ? 0 : 16 / 255.0;
+    offset[1] = offset[2] = 128 / 255.0;
+
+    // R = Y + 2(1-Kr)Cr
+    matrix[0] = y_scale;
+    matrix[1] = 0;
+    matrix[2] = 2 * (1 - kr) * c_scale;
+    // G = Y - 2Kb(1-Kb)/Kg Cb - 2Kr(1-Kr)/Kg Cr
+    matrix[3] = y_scale;
+    matrix[4] = -2 * kb * (1 - kb) / kg * c_scale;
+    matrix[5] = -2 * kr * (1 - kr) / kg * c_scale;
+    // B = Y + 2(1-Kb)Cb
+    matrix[6] = y_scale;
+    matrix[7] = 2 * (1 - kb) * c_scale;
+    matrix[8] = 0;
+}
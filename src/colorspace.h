@@ -0,0 +1,21 @@
+#ifndef _COLORSPACE_H_
+#define _COLORSPACE_H_
+
+// 各标准中亮度的R、B权重
+#define COLORSPACE_BT601_KR 0.299
+#define COLORSPACE_BT601_KB 0.114
+#define COLORSPACE_BT709_KR 0.2126
+#define COLORSPACE_BT709_KB 0.0722
+#define COLORSPACE_BT2020_KR 0.2627
+#define COLORSPACE_BT2020_KB 0.0593
+
+/**
+ * 计算YUV转RGB的参数：rgb = matrix * (yuv - offset)
+ *
+ * yuv为归一化到[0, 1]的采样值（即纹理中读出的值），matrix按行存储；
+ * full_range为0时表示有限范围（亮度16~235，色度16~240）。
+ */
+void colorspace_yuv_to_rgb(double kr, double kb, int full_range,
+                           float matrix[9], float offset[3]);
+
+#endif /* ifndef _COLORSPACE_H_ */
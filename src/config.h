@@ -1,20 +1,62 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-// TODO 队列大小使用时间来限制
-// 包队列的大小
-#define PKT_QUEUE_SIZE 20
-// 帧队列的大小
-#define FRAME_QUEUE_SIZE 40
+// 包队列最多容纳的包数量
+#define PKT_QUEUE_SIZE 256
+// 帧队列最多容纳的帧数量
+#define FRAME_QUEUE_SIZE 128
+
+// 视频转换队列最多容纳的帧数量
+#define CONVERT_QUEUE_SIZE 3
+
+// 每个流的包队列最多缓冲的时长和字节数
+#define PKT_QUEUE_MAX_DURATION (2 * 1000 * 1000)  // in microseconds
+#define PKT_QUEUE_MAX_BYTES (16 * 1024 * 1024)
+// 每个流的帧队列最多缓冲的时长和字节数
+#define FRAME_QUEUE_MAX_DURATION (500 * 1000)  // in microseconds
+#define FRAME_QUEUE_MAX_BYTES (64 * 1024 * 1024)
+// 队列元素数量低于该值时不受时长和字节数限制，避免单个元素过大时无法入队
+#define QUEUE_MIN_LENGTH 2
+
+// 默认的解码线程数，0表示根据CPU核数自动选择
+#define DECODE_THREAD_COUNT 0
+// 解码速率统计的周期
+#define DECODE_STAT_INTERVAL (1000 * 1000)  // in microseconds
+
+// 音频打包之后每个AL缓冲的时长
+#define AUDIO_BUFFER_DURATION (20 * 1000)  // in microseconds
+// AL播放队列最多缓冲的时长，决定了音频的输出延迟
+#define AUDIO_MAX_QUEUED_DURATION (200 * 1000)  // in microseconds
+// 回环设备的混音采样率，以及渲染线程每次取走的时长
+#define LOOPBACK_FREQUENCY 48000
+#define LOOPBACK_PERIOD (10 * 1000)  // in microseconds
+
+// 没有窗口时模拟的屏幕刷新率
+#define SIMULATED_REFRESH_RATE 60
 
 // 每次进入事件处理函数最多可以处理的事件数量
 #define MAX_EVENTS_PER_LOOP 10
-// 等待队列就绪的超时
-#define QUEUE_WAIT_MICROSECONDS 16 * 1000
 
 // 触发音画同步的阈值
-#define SYNC_DIFF_THRESHOLD (50 * 1000)  // in microseconds
-// 音画同步最多等待的帧数
+#define SYNC_DIFF_THRESHOLD (40 * 1000)  // in microseconds
+// 视频连续落后主时钟的帧数达到该值时，解码器跳过非参考帧
+#define DECODE_SKIP_LATE_FRAMES 5
+// 连续落后的帧数达到该值时，进一步只解码关键帧
+#define DECODE_SKIP_NONKEY_LATE_FRAMES 60
+// 连续按时的帧数达到该值时，跳过的级别降低一级
+#define DECODE_SKIP_RECOVER_FRAMES 30
+
+// 等待提交帧时，最多等待该帧数之后重新根据主时钟计算提交时刻
 #define SYNC_MAX_WAIT_FRAMES 1
+// 一帧最多等待的总时长，超过之后直接提交，避免时间戳跳变时长时间停在一帧上
+#define SYNC_MAX_WAIT (500 * 1000)  // in microseconds
+// 提交帧的时刻比渲染线程取帧的VSync提前的时长
+#define PRESENT_COMMIT_MARGIN (2 * 1000)  // in microseconds
+// 音频不是主时钟时，与主时钟的差值超过该阈值才通过重采样补偿
+#define AUDIO_SYNC_THRESHOLD (20 * 1000)  // in microseconds
+// 差值超过该阈值时认为时间戳有问题，不做补偿
+#define AUDIO_NOSYNC_THRESHOLD (10 * 1000 * 1000)  // in microseconds
+// 每帧最多拉伸或压缩的采样比例
+#define AUDIO_MAX_COMPENSATION_PERCENT 10
 
 #endif /* ifndef _CONFIG_H_ */
@@ -31,7 +31,18 @@ typedef struct {
 typedef struct {
     EVENT_OBJ_HEAD
 
+    /**
+     * SEEK_START：请求的目标位置；
+     * SEEK_END：实际的落点，即seek之后读到的第一个包的时间
+     */
     int64_t to_microseconds;
+    /** 发起seek时的播放位置，用于限制seek的方向 */
+    int64_t from_microseconds;
+    /**
+     * 精确seek：解码线程丢弃目标位置之前的帧，音频裁剪到目标位置对应的采样；
+     * 否则从关键帧的落点开始播放
+     */
+    int accurate;
 } SeekEvent;
 
 Event *event_alloc_base(enum EventType ype);
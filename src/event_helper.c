@@ -26,6 +26,7 @@ void process_play_events(StreamContext *sc, EventAction onPause,
         logCodec("[event-play] get type %d\n", event->type);
         switch (event->type) {
             case EVENT_PAUSE:
+                clock_set_speed(&sc->clock, 0);
                 if (onPause) {
                     onPause(sc);
                 }
@@ -35,6 +36,7 @@ void process_play_events(StreamContext *sc, EventAction onPause,
                 if (onResume) {
                     onResume(sc);
                 }
+                clock_set_speed(&sc->clock, 1);
             case EVENT_RESUME:
                 // pass
                 break;
@@ -44,9 +46,15 @@ void process_play_events(StreamContext *sc, EventAction onPause,
                 if (onSeek) {
                     onSeek(sc);
                 }
-                sc->play_time = ((SeekEvent *) event)->to_microseconds;
-                event_unref(
-                    wait_for_event(&sc->play_event_queue, EVENT_SEEK_END));
+                // seek期间时钟停在目标位置，恢复播放之后由播放线程更新
+                clock_update(&sc->clock,
+                             ((SeekEvent *) event)->to_microseconds, 0);
+                Event *seek_end =
+                    wait_for_event(&sc->play_event_queue, EVENT_SEEK_END);
+                // 以实际落点为准
+                clock_update(&sc->clock,
+                             ((SeekEvent *) seek_end)->to_microseconds, 0);
+                event_unref(seek_end);
             } break;
             default:
                 break;
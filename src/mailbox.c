@@ -0,0 +1,40 @@
+#include "mailbox.h"
+
+#define MAILBOX_DIRTY 4
+#define MAILBOX_INDEX_MASK 3
+
+void mailbox_init(Mailbox *mb, void *slots[3]) {
+    for (int i = 0; i < 3; i++) {
+        mb->slots[i] = slots[i];
+    }
+    mb->back = 0;
+    mb->front = 1;
+    atomic_init(&mb->middle, 2);
+}
+
+void *mailbox_back(Mailbox *mb) {
+    return mb->slots[mb->back];
+}
+
+int mailbox_publish(Mailbox *mb) {
+    // acq_rel：发布back中写入的内容，同时获取消费者对换出的槽的最后访问
+    int old = atomic_exchange_explicit(
+        &mb->middle, mb->back | MAILBOX_DIRTY, memory_order_acq_rel);
+    mb->back = old & MAILBOX_INDEX_MASK;
+    return (old & MAILBOX_DIRTY) != 0;
+}
+
+int mailbox_fetch(Mailbox *mb) {
+    if (!(atomic_load_explicit(&mb->middle, memory_order_relaxed) &
+          MAILBOX_DIRTY)) {
+        return 0;
+    }
+    int old = atomic_exchange_explicit(&mb->middle, mb->front,
+                                       memory_order_acq_rel);
+    mb->front = old & MAILBOX_INDEX_MASK;
+    return 1;
+}
+
+void *mailbox_front(Mailbox *mb) {
+    return mb->slots[mb->front];
+}
@@ -0,0 +1,41 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <stdatomic.h>
+
+/**
+ * 只保留最新值的邮箱（三缓冲），单生产者、单消费者、无锁
+ *
+ * 三个槽分别由生产者（back）、消费者（front）持有，剩下的一个在中间交换。
+ * 生产者写完back之后与中间槽交换；消费者取数据时，如果中间槽有新数据，
+ * 就与front交换。槽里的数据由使用方预先分配并反复使用，邮箱本身不分配内存。
+ */
+typedef struct {
+    void *slots[3];
+    /** 生产者持有的槽，只有生产者访问 */
+    int back;
+    /** 消费者持有的槽，只有消费者访问 */
+    int front;
+    /** 中间槽的序号，带有MAILBOX_DIRTY时表示有新数据还未被取走 */
+    atomic_int middle;
+} Mailbox;
+
+void mailbox_init(Mailbox *mb, void *slots[3]);
+/**
+ * 生产者：获取可以写入的槽
+ */
+void *mailbox_back(Mailbox *mb);
+/**
+ * 生产者：发布写好的槽，返回1表示覆盖了一个还未被取走的值
+ */
+int mailbox_publish(Mailbox *mb);
+/**
+ * 消费者：如果有新发布的值，切换到该值并返回1，否则返回0
+ */
+int mailbox_fetch(Mailbox *mb);
+/**
+ * 消费者：获取当前持有的槽，在下一次mailbox_fetch之前一直有效
+ */
+void *mailbox_front(Mailbox *mb);
+
+#endif /* ifndef _MAILBOX_H_ */
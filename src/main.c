@@ -1,7 +1,13 @@
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "audio.h"
 #include "codec.h"
+#include "config.h"
 #include "list.h"
 #include "render.h"
 #include "video.h"
@@ -11,6 +17,15 @@ static AVFormatContext *fc = NULL;
 static AVStream *v_stream = NULL, *a_stream = NULL;
 static const AVCodec *v_codec = NULL, *a_codec = NULL;
 static AVCodecContext *v_cc = NULL, *a_cc = NULL;
+static DecodeOptions v_decode_opts = {
+    .thread_count = DECODE_THREAD_COUNT,
+    .thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE,
+};
+static DecodeOptions a_decode_opts = {
+    .thread_count = DECODE_THREAD_COUNT,
+    .thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE,
+};
+static enum ClockMaster clock_master = CLOCK_MASTER_AUDIO;
 
 static AVStream *find_stream_by_type(const AVFormatContext *fc,
                                      enum AVMediaType type) {
@@ -24,8 +39,8 @@ static AVStream *find_stream_by_type(const AVFormatContext *fc,
     return NULL;
 }
 
-static void get_codec(const AVStream *stream, const AVCodec **outCodec,
-                      AVCodecContext **outCodecCtx) {
+static void get_codec(const AVStream *stream, const DecodeOptions *opts,
+                      const AVCodec **outCodec, AVCodecContext **outCodecCtx) {
     int ret;
     const AVCodec *codec;
     AVCodecContext *cc;
@@ -45,10 +60,16 @@ static void get_codec(const AVStream *stream, const AVCodec **outCodec,
     if ((ret = avcodec_parameters_to_context(cc, stream->codecpar)) != 0) {
         averror(ret, "avcodec_parameters_to_context");
     }
+    // avcodec 多线程解码，需要在打开解码器之前设置
+    cc->thread_count = opts->thread_count;
+    cc->thread_type = opts->thread_type;
     // avcodec 打开解码器
     if ((ret = avcodec_open2(cc, codec, NULL)) != 0) {
         averror(ret, "open codec");
     }
+    logCodec("[%s-decode] decoder=%s, threads=%d, thread_type=%d\n",
+             av_get_media_type_string(cc->codec_type), codec->name,
+             cc->thread_count, cc->active_thread_type);
     *outCodec = codec;
     *outCodecCtx = cc;
 }
@@ -72,39 +93,191 @@ static void init_decode(const char *file) {
         error("no available stream found");
     }
     if (v_stream) {
-        get_codec(v_stream, &v_codec, &v_cc);
+        get_codec(v_stream, &v_decode_opts, &v_codec, &v_cc);
     }
     if (a_stream) {
-        get_codec(a_stream, &a_codec, &a_cc);
+        get_codec(a_stream, &a_decode_opts, &a_codec, &a_cc);
     }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        dprintf(2, "usage: %s FILE\n", argv[0]);
+static void usage(const char *prog) {
+    dprintf(2,
+            "usage: %s [options] FILE\n"
+            "  -t [v:|a:]N        decode threads, 0 for auto\n"
+            "  -T [v:|a:]TYPE     decode threading: frame, slice or auto\n"
+            "  -a BACKEND         audio output: openal, loopback or "
+            "loopback-fast\n"
+            "  -v SINK            video output: window, offscreen or null\n"
+            "  -c CLOCK           master clock: audio, video or external\n",
+            prog);
+    exit(-1);
+}
+
+/**
+ * 解析"v:VALUE"、"a:VALUE"或"VALUE"形式的参数，返回VALUE，
+ * 同时在opts中返回需要设置的流，不需要设置的为NULL
+ */
+static const char *parse_stream_spec(const char *arg, DecodeOptions *opts[2]) {
+    opts[0] = &v_decode_opts;
+    opts[1] = &a_decode_opts;
+    if (arg[0] == 'v' && arg[1] == ':') {
+        opts[1] = NULL;
+        return arg + 2;
+    } else if (arg[0] == 'a' && arg[1] == ':') {
+        opts[0] = NULL;
+        return arg + 2;
+    }
+    return arg;
+}
+
+/**
+ * 解析解码线程数，必须是完整的非负整数，否则返回-1
+ */
+static int parse_thread_count(const char *value) {
+    char *end;
+    errno = 0;
+    long count = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE || count < 0 ||
+        count > INT_MAX) {
         return -1;
     }
-    init_decode(argv[1]);
+    return (int) count;
+}
+
+static int parse_thread_type(const char *value) {
+    if (strcmp(value, "frame") == 0) {
+        return FF_THREAD_FRAME;
+    } else if (strcmp(value, "slice") == 0) {
+        return FF_THREAD_SLICE;
+    } else if (strcmp(value, "auto") == 0) {
+        return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+    return -1;
+}
+
+static int parse_audio_backend(const char *value) {
+    if (strcmp(value, "openal") == 0) {
+        return AUDIO_BACKEND_OPENAL;
+    } else if (strcmp(value, "loopback") == 0) {
+        return AUDIO_BACKEND_LOOPBACK;
+    } else if (strcmp(value, "loopback-fast") == 0) {
+        return AUDIO_BACKEND_LOOPBACK_FAST;
+    }
+    return -1;
+}
+
+static int parse_video_sink(const char *value) {
+    if (strcmp(value, "window") == 0) {
+        return VIDEO_SINK_WINDOW;
+    } else if (strcmp(value, "offscreen") == 0) {
+        return VIDEO_SINK_OFFSCREEN;
+    } else if (strcmp(value, "null") == 0) {
+        return VIDEO_SINK_NULL;
+    }
+    return -1;
+}
+
+static int parse_clock_master(const char *value) {
+    if (strcmp(value, "audio") == 0) {
+        return CLOCK_MASTER_AUDIO;
+    } else if (strcmp(value, "video") == 0) {
+        return CLOCK_MASTER_VIDEO;
+    } else if (strcmp(value, "external") == 0) {
+        return CLOCK_MASTER_EXTERNAL;
+    }
+    return -1;
+}
+
+static const char *parse_args(int argc, char *argv[]) {
+    int opt;
+    DecodeOptions *opts[2];
+    const char *value;
+
+    while ((opt = getopt(argc, argv, "t:T:a:v:c:")) != -1) {
+        switch (opt) {
+            case 't': {
+                value = parse_stream_spec(optarg, opts);
+                int count = parse_thread_count(value);
+                if (count < 0) {
+                    usage(argv[0]);
+                }
+                for (int i = 0; i < 2; i++) {
+                    if (opts[i]) {
+                        opts[i]->thread_count = count;
+                    }
+                }
+            } break;
+            case 'T': {
+                value = parse_stream_spec(optarg, opts);
+                int type = parse_thread_type(value);
+                if (type < 0) {
+                    usage(argv[0]);
+                }
+                for (int i = 0; i < 2; i++) {
+                    if (opts[i]) {
+                        opts[i]->thread_type = type;
+                    }
+                }
+            } break;
+            case 'a': {
+                int backend = parse_audio_backend(optarg);
+                if (backend < 0) {
+                    usage(argv[0]);
+                }
+                set_audio_backend(backend);
+            } break;
+            case 'v': {
+                int sink = parse_video_sink(optarg);
+                if (sink < 0) {
+                    usage(argv[0]);
+                }
+                set_video_sink(sink);
+            } break;
+            case 'c': {
+                int master = parse_clock_master(optarg);
+                if (master < 0) {
+                    usage(argv[0]);
+                }
+                clock_master = master;
+            } break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    return argv[optind];
+}
 
-    pthread_t t_a, t_a_play, t_v, t_v_play, t_demux;
+int main(int argc, char *argv[]) {
+    init_decode(parse_args(argc, argv));
+
+    pthread_t t_a, t_a_play, t_v, t_v_convert, t_v_play, t_demux;
     PlayContext ctx = {0};
 
     ctx.fc = fc;
     ctx.state = STATE_PLAYING;
-    queue_init(&ctx.demux_event_queue);
+    play_context_init(&ctx);
+    // 没有对应的流时退回到可用的时钟
+    ctx.clock_master = clock_master;
+    if (ctx.clock_master == CLOCK_MASTER_AUDIO && !a_cc) {
+        ctx.clock_master = CLOCK_MASTER_EXTERNAL;
+    } else if (ctx.clock_master == CLOCK_MASTER_VIDEO && !v_cc) {
+        ctx.clock_master = CLOCK_MASTER_AUDIO;
+    }
+    logCodec("[main] clock master=%d\n", ctx.clock_master);
     if (v_cc) {
         ctx.video_sc = malloc(sizeof(StreamContext));
         *ctx.video_sc = (StreamContext){
             .media_type = AVMEDIA_TYPE_VIDEO,
             .stream = v_stream,
             .cc = v_cc,
-            .play_time = 0,
         };
-        queue_init(&ctx.video_sc->pkt_queue);
-        queue_init(&ctx.video_sc->frame_queue);
-        queue_init(&ctx.video_sc->play_event_queue);
-        queue_init(&ctx.video_sc->decode_event_queue);
+        stream_context_init(ctx.video_sc);
         pthread_create(&t_v, NULL, (void *) decode_video_thread, &ctx);
+        pthread_create(&t_v_convert, NULL, (void *) video_convert_thread,
+                       &ctx);
         pthread_create(&t_v_play, NULL, (void *) video_play_thread, &ctx);
     }
     if (a_cc) {
@@ -113,12 +286,8 @@ int main(int argc, char *argv[]) {
             .media_type = AVMEDIA_TYPE_AUDIO,
             .stream = a_stream,
             .cc = a_cc,
-            .play_time = 0,
         };
-        queue_init(&ctx.audio_sc->pkt_queue);
-        queue_init(&ctx.audio_sc->frame_queue);
-        queue_init(&ctx.audio_sc->play_event_queue);
-        queue_init(&ctx.audio_sc->decode_event_queue);
+        stream_context_init(ctx.audio_sc);
         pthread_create(&t_a, NULL, (void *) decode_audio_thread, &ctx);
         pthread_create(&t_a_play, NULL, (void *) audio_play_thread, &ctx);
     }
@@ -127,6 +296,7 @@ int main(int argc, char *argv[]) {
     pthread_create(&t_demux, NULL, (void *) demux_thread, &ctx);
     if (v_cc) {
         pthread_join(t_v, NULL);
+        pthread_join(t_v_convert, NULL);
         pthread_join(t_v_play, NULL);
         stop_render();
     }
@@ -1,6 +1,8 @@
 #include "queue.h"
 
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 static inline void lock(Queue *queue) {
     if (pthread_mutex_lock(&queue->lock) != 0) {
@@ -8,30 +10,131 @@ static inline void lock(Queue *queue) {
     }
 }
 
+static inline void unlock(Queue *queue) {
+    if (pthread_mutex_unlock(&queue->lock) != 0) {
+        error("pthread_mutex_unlock");
+    }
+}
+
 static inline void broadcast_and_unlock(Queue *queue) {
     if (pthread_cond_broadcast(&queue->on_changed) != 0) {
         error("pthread_cond_broadcast");
     }
-    if (pthread_mutex_unlock(&queue->lock) != 0) {
-        error("pthread_mutex_unlock");
-    }
+    unlock(queue);
 }
 
-void queue_init(Queue *q) {
+static void queue_init_common(Queue *q) {
     pthread_condattr_t cond_attr;
 
-    q->length = 0;
+    atomic_init(&q->length, 0);
     list_node_init(&q->nodes.queue);
     q->nodes.data = NULL;
+    q->ring = NULL;
+    q->capacity = 0;
+    q->mask = 0;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->waiters, 0);
+    for (int i = 0; i < 2; i++) {
+        atomic_init(&q->wait_fds[i], -1);
+        atomic_init(&q->fd_waiters[i], 0);
+    }
+    q->measurer = NULL;
+    atomic_init(&q->bytes, 0);
+    atomic_init(&q->duration, 0);
+    atomic_init(&q->epoch, 0);
 
     if (pthread_mutex_init(&q->lock, NULL) != 0) {
         error("queue_init: mutex initialize failed");
     }
 
+    pthread_condattr_init(&cond_attr);
     pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
     if (pthread_cond_init(&q->on_changed, &cond_attr) != 0) {
         error("queue_init: cond initialize failed");
     }
+    pthread_condattr_destroy(&cond_attr);
+}
+
+void queue_init(Queue *q) {
+    queue_init_common(q);
+}
+
+void queue_init_spsc(Queue *q, int capacity) {
+    unsigned int size = 1;
+
+    assert(capacity > 0);
+    queue_init_common(q);
+    // 大小取2的幂，保证head/tail溢出回绕之后下标依然连续
+    while (size < (unsigned int) capacity) {
+        size <<= 1;
+    }
+    q->ring = malloc(sizeof(*q->ring) * size);
+    if (q->ring == NULL) {
+        error("queue_init_spsc: alloc ring failed");
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        atomic_init(&q->ring[i], NULL);
+    }
+    q->capacity = capacity;
+    q->mask = size - 1;
+}
+
+void queue_set_measurer(Queue *q, DataMeasurer measurer) {
+    q->measurer = measurer;
+}
+
+int queue_get_wait_fd(Queue *queue, enum QueueWaitFor wait_for) {
+    int fd = queue->wait_fds[wait_for];
+    if (fd >= 0) {
+        return fd;
+    }
+    lock(queue);
+    fd = queue->wait_fds[wait_for];
+    if (fd < 0) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            error("queue_get_wait_fd: eventfd failed");
+        }
+        queue->wait_fds[wait_for] = fd;
+    }
+    unlock(queue);
+    return fd;
+}
+
+void queue_watch(Queue *queue, enum QueueWaitFor wait_for) {
+    queue->fd_waiters[wait_for]++;
+}
+
+void queue_unwatch(Queue *queue, enum QueueWaitFor wait_for) {
+    queue->fd_waiters[wait_for]--;
+}
+
+/**
+ * 通知等待wait_for方向的selector
+ */
+static void signal_wait_fd(Queue *queue, enum QueueWaitFor wait_for) {
+    uint64_t one = 1;
+    if (queue->fd_waiters[wait_for] > 0) {
+        // eventfd是非阻塞的，计数溢出时写入失败，但此时fd已经是可读的
+        if (write(queue->wait_fds[wait_for], &one, sizeof(one)) < 0 &&
+            errno != EAGAIN) {
+            error("signal_wait_fd: write eventfd failed");
+        }
+    }
+}
+
+/**
+ * 更新队列的字节数和时长，sign为1表示入队，-1表示出队
+ */
+static void queue_account(Queue *queue, const void *data, int sign) {
+    int64_t bytes = 0, duration = 0;
+    if (!queue->measurer) {
+        return;
+    }
+    queue->measurer(queue, data, &bytes, &duration);
+    queue->bytes += sign * bytes;
+    queue->duration += sign * duration;
 }
 
 static void queue_enqueue_locked(Queue *queue, void *data) {
@@ -39,6 +142,7 @@ static void queue_enqueue_locked(Queue *queue, void *data) {
     q_node->data = data;
     list_add(queue->nodes.queue.prev, &q_node->queue);
     queue->length++;
+    queue_account(queue, data, 1);
 }
 
 static void *queue_dequeue_locked(Queue *queue) {
@@ -49,96 +153,315 @@ static void *queue_dequeue_locked(Queue *queue) {
     list_del(&q_node->queue);
     void *data = q_node->data;
     queue->length--;
+    queue_account(queue, data, -1);
     free(q_node);
     return data;
 }
 
+/**
+ * 只能由生产者调用，队列满时返回0
+ */
+static int ring_push(Queue *queue, void *data) {
+    unsigned int tail =
+        atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head =
+        atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head >= (unsigned int) queue->capacity) {
+        return 0;
+    }
+    queue_account(queue, data, 1);
+    atomic_store_explicit(&queue->ring[tail & queue->mask], data,
+                          memory_order_relaxed);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    // 先发布tail再增加length，保证看到length的线程一定能取到数据
+    queue->length++;
+    return 1;
+}
+
+/**
+ * 消费者或生产者调用，队列为空时返回0
+ */
+static int ring_pop(Queue *queue, void **data_ptr) {
+    unsigned int head =
+        atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;) {
+        unsigned int tail =
+            atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == tail) {
+            return 0;
+        }
+        void *data = atomic_load_explicit(&queue->ring[head & queue->mask],
+                                          memory_order_relaxed);
+        // 只有head没被其他线程推进时，读到的数据才是有效的
+        if (atomic_compare_exchange_weak_explicit(
+                &queue->head, &head, head + 1, memory_order_release,
+                memory_order_relaxed)) {
+            queue->length--;
+            queue_account(queue, data, -1);
+            *data_ptr = data;
+            return 1;
+        }
+    }
+}
+
+/**
+ * 唤醒等待的线程，wake_for为被唤醒的一方所等待的方向
+ */
+static void ring_notify(Queue *queue, enum QueueWaitFor wake_for) {
+    // length、bytes、duration的修改和waiters的读取都是seq_cst的，与等待方的顺序相反，
+    // 因此不会出现双方都没看到对方修改的情况
+    if (queue->waiters > 0) {
+        lock(queue);
+        broadcast_and_unlock(queue);
+    }
+    signal_wait_fd(queue, wake_for);
+}
+
+int queue_ready(Queue *queue, QueuePrediction pred,
+                enum QueueWaitFor wait_for) {
+    if (wait_for == QUEUE_WAIT_ENQUEUE && queue->ring &&
+        queue->length >= queue->capacity) {
+        return 0;
+    }
+    return pred(queue);
+}
+
+static void get_deadline(struct timespec *ts, int64_t microseconds) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    int64_t nano = microseconds * 1000 + ts->tv_nsec;
+    ts->tv_nsec = nano % (1000 * 1000 * 1000);
+    ts->tv_sec += nano / (1000 * 1000 * 1000);
+}
+
+/**
+ * 在持有锁的情况下等待，deadline为NULL时一直等待
+ */
+static int queue_wait_locked(Queue *queue, QueuePrediction pred,
+                             enum QueueWaitFor wait_for,
+                             const struct timespec *deadline) {
+    int ret = 0;
+    while (!queue_ready(queue, pred, wait_for) && ret == 0) {
+        if (deadline) {
+            ret = pthread_cond_timedwait(&queue->on_changed, &queue->lock,
+                                         deadline);
+        } else {
+            ret = pthread_cond_wait(&queue->on_changed, &queue->lock);
+        }
+    }
+    if (ret == 0) {
+        return 1;
+    } else if (ret == ETIMEDOUT) {
+        return 0;
+    } else {
+        error("pthread_cond_wait failed\n");
+    }
+}
+
+/**
+ * SPSC模式的等待，不持有锁，只在条件不满足时才进入条件变量
+ */
+static int ring_wait(Queue *queue, QueuePrediction pred,
+                     enum QueueWaitFor wait_for,
+                     const struct timespec *deadline) {
+    if (queue_ready(queue, pred, wait_for)) {
+        return 1;
+    }
+    queue->waiters++;
+    lock(queue);
+    int ret = queue_wait_locked(queue, pred, wait_for, deadline);
+    unlock(queue);
+    queue->waiters--;
+    return ret;
+}
+
+static int queue_always(Queue *queue) {
+    return 1;
+}
+
+static void ring_enqueue(Queue *queue, void *data) {
+    if (!ring_push(queue, data)) {
+        error("ring_enqueue: queue is full");
+    }
+    ring_notify(queue, QUEUE_WAIT_DEQUEUE);
+}
+
+static void *ring_dequeue(Queue *queue) {
+    void *data = NULL;
+    if (ring_pop(queue, &data)) {
+        ring_notify(queue, QUEUE_WAIT_ENQUEUE);
+    }
+    return data;
+}
+
+/**
+ * 等待并出队，成功取到元素时返回1，超时返回0
+ *
+ * 等待和出队不是原子的，期间生产者可能清空了队列（参见queue_clear），
+ * 这时重新等待，而不是返回NULL：NULL元素表示流结束
+ */
+static int ring_dequeue_wait(Queue *queue, QueuePrediction pred,
+                             const struct timespec *deadline,
+                             void **data_ptr) {
+    for (;;) {
+        if (!ring_wait(queue, pred, QUEUE_WAIT_DEQUEUE, deadline)) {
+            return 0;
+        }
+        if (ring_pop(queue, data_ptr)) {
+            ring_notify(queue, QUEUE_WAIT_ENQUEUE);
+            return 1;
+        }
+    }
+}
+
 void queue_enqueue(Queue *queue, void *data) {
+    if (queue->ring) {
+        queue_enqueue_wait(queue, data, queue_always);
+        return;
+    }
     lock(queue);
     queue_enqueue_locked(queue, data);
     broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_DEQUEUE);
 }
 
 void *queue_dequeue(Queue *queue) {
+    if (queue->ring) {
+        return ring_dequeue(queue);
+    }
     lock(queue);
     void *v = queue_dequeue_locked(queue);
     broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_ENQUEUE);
     return v;
 }
 
-static void queue_wait_locked(Queue *queue, QueuePrediction pred) {
-    while (!pred(queue)) {
-        int ret;
-        if ((ret = pthread_cond_wait(&queue->on_changed, &queue->lock)) != 0) {
-            error("pthread_cond_wait failed\n");
+int queue_try_dequeue(Queue *queue, void **data_ptr) {
+    if (queue->ring) {
+        if (!ring_pop(queue, data_ptr)) {
+            return 0;
         }
-    }
-}
-
-static int queue_timedwait_locked(Queue *queue, QueuePrediction pred,
-                                  int64_t microseconds) {
-    int ret = 0;
-    struct timespec ts;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    int64_t nano = microseconds * 1000 + ts.tv_nsec;
-    ts.tv_nsec = nano % (1000 * 1000 * 1000);
-    ts.tv_sec += nano / (1000 * 1000 * 1000);
-    while (!pred(queue) && ret == 0) {
-        ret = pthread_cond_timedwait(&queue->on_changed, &queue->lock, &ts);
-    }
-    if (ret == 0) {
+        ring_notify(queue, QUEUE_WAIT_ENQUEUE);
         return 1;
-    } else if (ret == ETIMEDOUT) {
+    }
+    lock(queue);
+    if (queue->length == 0) {
+        unlock(queue);
         return 0;
-    } else {
-        error("pthread_cond_wait failed\n");
     }
+    *data_ptr = queue_dequeue_locked(queue);
+    broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_ENQUEUE);
+    return 1;
 }
 
 void queue_enqueue_wait(Queue *queue, void *data, QueuePrediction pred) {
+    if (queue->ring) {
+        ring_wait(queue, pred, QUEUE_WAIT_ENQUEUE, NULL);
+        ring_enqueue(queue, data);
+        return;
+    }
     lock(queue);
-    queue_wait_locked(queue, pred);
+    queue_wait_locked(queue, pred, QUEUE_WAIT_ENQUEUE, NULL);
     queue_enqueue_locked(queue, data);
     broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_DEQUEUE);
 }
 
 void *queue_dequeue_wait(Queue *queue, QueuePrediction pred) {
+    if (queue->ring) {
+        void *data;
+        ring_dequeue_wait(queue, pred, NULL, &data);
+        return data;
+    }
     lock(queue);
-    queue_wait_locked(queue, pred);
+    queue_wait_locked(queue, pred, QUEUE_WAIT_DEQUEUE, NULL);
     void *v = queue_dequeue_locked(queue);
     broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_ENQUEUE);
     return v;
 }
 
 int queue_enqueue_timedwait(Queue *queue, void *data, QueuePrediction pred,
                             int64_t microseconds) {
+    struct timespec ts;
+    get_deadline(&ts, microseconds);
+    if (queue->ring) {
+        int pred_succ = ring_wait(queue, pred, QUEUE_WAIT_ENQUEUE, &ts);
+        if (pred_succ) {
+            ring_enqueue(queue, data);
+        }
+        return pred_succ;
+    }
     lock(queue);
-    int pred_succ = queue_timedwait_locked(queue, pred, microseconds);
+    int pred_succ = queue_wait_locked(queue, pred, QUEUE_WAIT_ENQUEUE, &ts);
     if (pred_succ) {
         queue_enqueue_locked(queue, data);
     }
     broadcast_and_unlock(queue);
+    if (pred_succ) {
+        signal_wait_fd(queue, QUEUE_WAIT_DEQUEUE);
+    }
     return pred_succ;
 }
 
 int queue_dequeue_timedwait(Queue *queue, QueuePrediction pred,
                             int64_t microseconds, void **data_ptr) {
+    struct timespec ts;
+    get_deadline(&ts, microseconds);
+    if (queue->ring) {
+        return ring_dequeue_wait(queue, pred, &ts, data_ptr);
+    }
     lock(queue);
-    int pred_succ = queue_timedwait_locked(queue, pred, microseconds);
+    int pred_succ = queue_wait_locked(queue, pred, QUEUE_WAIT_DEQUEUE, &ts);
     if (pred_succ) {
         *data_ptr = queue_dequeue_locked(queue);
     }
     broadcast_and_unlock(queue);
+    if (pred_succ) {
+        signal_wait_fd(queue, QUEUE_WAIT_ENQUEUE);
+    }
     return pred_succ;
 }
 
+int queue_enqueue_tagged(Queue *queue, void *data, unsigned int epoch,
+                         DataCleaner data_cleaner) {
+    if (queue->ring) {
+        if (queue->epoch != epoch) {
+            data_cleaner(data);
+            return 0;
+        }
+        ring_enqueue(queue, data);
+        return 1;
+    }
+    lock(queue);
+    if (queue->epoch != epoch) {
+        unlock(queue);
+        data_cleaner(data);
+        return 0;
+    }
+    queue_enqueue_locked(queue, data);
+    broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_DEQUEUE);
+    return 1;
+}
+
 void queue_clear(Queue *queue, DataCleaner data_cleaner) {
+    if (queue->ring) {
+        void *data;
+        queue->epoch++;
+        while (ring_pop(queue, &data)) {
+            data_cleaner(data);
+        }
+        ring_notify(queue, QUEUE_WAIT_ENQUEUE);
+        return;
+    }
     lock(queue);
+    queue->epoch++;
     while (queue->length > 0) {
         void *data = queue_dequeue_locked(queue);
         // TODO 是否需要在释放锁之后再清理数据，避免锁定事件太长
         data_cleaner(data);
     }
     broadcast_and_unlock(queue);
+    signal_wait_fd(queue, QUEUE_WAIT_ENQUEUE);
 }
@@ -2,6 +2,7 @@
 #define _QUEUE_H_
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "list.h"
 
@@ -10,23 +11,111 @@ typedef struct {
     void *data;
 } QueueNode;
 
-typedef struct {
+struct Queue;
+
+/**
+ * 等待的方向：等待可以出队（消费者）或等待可以入队（生产者）
+ */
+enum QueueWaitFor {
+    QUEUE_WAIT_DEQUEUE,
+    QUEUE_WAIT_ENQUEUE,
+};
+
+/**
+ * 计算一个元素占用的字节数和时长（微秒），用于限制队列的缓冲深度
+ */
+typedef void (*DataMeasurer)(struct Queue *queue, const void *data,
+                             int64_t *bytes, int64_t *duration);
+
+typedef struct Queue {
     pthread_mutex_t lock;
     pthread_cond_t on_changed;
-    int length;
+    atomic_int length;
     QueueNode nodes;
+
+    /**
+     * SPSC模式下的环形缓冲区，为NULL时使用链表模式
+     *
+     * 环形缓冲区只允许一个生产者，入队不需要加锁；出队通过CAS推进head，
+     * 因此除了消费者之外，生产者也可以安全地清空队列（参见queue_clear）。
+     * 锁和条件变量只在需要等待的时候使用。
+     */
+    _Atomic(void *) *ring;
+    /** 队列最多容纳的元素数量 */
+    int capacity;
+    /** 环形缓冲区的实际大小减1（大小为2的幂） */
+    unsigned int mask;
+    atomic_uint head, tail;
+    /** 正在等待条件变量的线程数，为0时SPSC模式不需要唤醒 */
+    atomic_int waiters;
+
+    /**
+     * 按等待方向划分的eventfd，-1表示尚未创建，供selector使用
+     *
+     * 入队之后通知QUEUE_WAIT_DEQUEUE，出队和清空之后通知QUEUE_WAIT_ENQUEUE。
+     * 每个方向只有一个线程等待，因此等待方清空eventfd不会吞掉其他线程的通知。
+     */
+    atomic_int wait_fds[2];
+    /** 正在通过eventfd等待的线程数，为0时不需要写eventfd */
+    atomic_int fd_waiters[2];
+
+    /** 队列中所有元素的字节数和时长之和，需要设置measurer */
+    DataMeasurer measurer;
+    atomic_llong bytes, duration;
+
+    /**
+     * 清空的代数，每次queue_clear加1
+     *
+     * 生产者在产生数据之前记下当前的代数，入队时如果代数已经变化，
+     * 说明期间发生了清空（如seek），数据已经过期，需要丢弃。
+     */
+    atomic_uint epoch;
 } Queue;
 
 typedef int (*QueuePrediction)(Queue *queue);
 typedef void (*DataCleaner)(void *);
 
 void queue_init(Queue *q);
+/**
+ * 初始化为单生产者、单消费者的无锁环形队列，最多容纳capacity个元素
+ *
+ * 接口与普通队列一致，但入队只能在同一个线程中进行；队列满时，
+ * 入队操作会等待队列有空间。
+ */
+void queue_init_spsc(Queue *q, int capacity);
+
+/**
+ * 设置元素的计量函数，需要在队列使用之前调用
+ */
+void queue_set_measurer(Queue *q, DataMeasurer measurer);
 
 void queue_enqueue(Queue *queue, void *data);
 void *queue_dequeue(Queue *queue);
+/**
+ * 不等待地出队，取到元素（包括表示结束的NULL）时返回1，队列为空时返回0。
+ *
+ * 与queue_dequeue不同，可以区分队列为空和取到NULL；selector报告可以出队
+ * 之后，队列仍可能在出队之前被清空，需要用它来判断是否重新等待。
+ */
+int queue_try_dequeue(Queue *queue, void **data_ptr);
 
+/**
+ * 清空队列，同时使之前获取的代数失效
+ */
 void queue_clear(Queue *queue, DataCleaner data_cleaner);
 
+static unsigned int queue_epoch(Queue *queue) {
+    return queue->epoch;
+}
+/**
+ * 如果期间没有发生过清空（代数仍为epoch），则入队并返回1，
+ * 否则使用data_cleaner释放数据并返回0；不会等待
+ *
+ * SPSC模式下，清空需要由生产者进行才能保证过期数据不会入队。
+ */
+int queue_enqueue_tagged(Queue *queue, void *data, unsigned int epoch,
+                         DataCleaner data_cleaner);
+
 void queue_enqueue_wait(Queue *queue, void *data, QueuePrediction pred);
 void *queue_dequeue_wait(Queue *queue, QueuePrediction pred);
 int queue_dequeue_timedwait(Queue *queue, QueuePrediction pred,
@@ -34,6 +123,21 @@ int queue_dequeue_timedwait(Queue *queue, QueuePrediction pred,
 int queue_enqueue_timedwait(Queue *queue, void *data, QueuePrediction pred,
                             int64_t microseconds);
 
+/**
+ * 获取等待的句柄（eventfd），队列状态可能变化时变为可读
+ */
+int queue_get_wait_fd(Queue *queue, enum QueueWaitFor wait_for);
+/**
+ * 开始/结束通过wait fd等待，只有在watch期间队列才会通知wait fd
+ */
+void queue_watch(Queue *queue, enum QueueWaitFor wait_for);
+void queue_unwatch(Queue *queue, enum QueueWaitFor wait_for);
+/**
+ * 判断是否可以出队/入队，SPSC模式的入队还需要环形缓冲区有空间
+ */
+int queue_ready(Queue *queue, QueuePrediction pred,
+                enum QueueWaitFor wait_for);
+
 static int queue_has_data(Queue *q) {
     return q->length > 0;
 }
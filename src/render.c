@@ -6,8 +6,17 @@
 #include <GLFW/glfw3.h>
 // clang-format on
 
+#include <libavutil/pixdesc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "colorspace.h"
+#include "config.h"
 #include "event.h"
-#include "queue.h"
+#include "mailbox.h"
 #include "utils.h"
 
 static pthread_t tid;
@@ -15,23 +24,60 @@ static PlayContext *pc;
 /**
  * 用于视频帧消费线程与渲染线程之间的交互。
  *
- * 与上面几个队列相比，渲染线程作为消费者的消费逻辑不太一样，
- * 它不会保证处理队列里面的每一个元素，而是每次只取队列的最
- * 后一个元素，同时跳过并释放其他元素。
+ * 渲染线程不会保证处理每一帧，而是每次只取最新的一帧。这是由于
+ * 渲染需要尽量使得每帧都能显示出最新的画面，而不能因为排队而延迟。
+ * 具体来说，渲染线程由VSync驱动，视频播放线程由视频帧率驱动，如果
+ * 遇到高帧率视频，或是屏幕刷新率低，导致视频播放线程更新速率大于
+ * 等于VSync速率，中间的帧会被直接覆盖，而渲染线程只需要取最新一帧
+ * 即可，确保及时渲染。
  *
- * 这是由于渲染队列需要尽量使得每帧都能显示出最新的画面，
- * 而不能因为排队而延迟。具体来说，渲染队列由VSync驱动，
- * 视频播放线程由视频帧率驱动，因此通常比视频播放线程更新
- * 频率高，这时候该队列基本上长度都小于等于1；如果遇到高
- * 帧率视频，或是屏幕刷新率低，导致视频播放线程更新速率大
- * 于等于VSync速率，该队列就会堆积多个帧，而渲染线程只需
- * 要取最新一帧即可，确保及时渲染。
- */
-static Queue to_render;
+ * 因此这里使用三缓冲的邮箱，三个槽都是预先分配的AVFrame，提交时
+ * 只增加Buffer的引用，不需要加锁和分配内存。
+ */
+static Mailbox to_render;
+static AVFrame *render_slots[3];
 static int stop_requested = 0;
+static enum VideoSink video_sink = VIDEO_SINK_WINDOW;
+/** 模拟的下一次VSync时间，没有窗口时用来控制呈现的节奏 */
+static struct timespec next_vsync;
+/** 实际呈现的帧数，退出时输出，用于统计 */
+static int64_t presented_frames;
+/**
+ * 最近一次VSync的时刻和VSync周期，由渲染线程发布，视频播放线程据此安排
+ * 提交帧的时刻，单位：微秒
+ */
+static atomic_llong last_vsync, vsync_period;
+
+/**
+ * 渲染器可以直接绘制的格式，与片段着色器中的format对应
+ */
+enum RenderFormat {
+    RENDER_FORMAT_RGB,
+    RENDER_FORMAT_YUV,
+    RENDER_FORMAT_NV12,
+};
+
+// 每个平面的PBO数量，交替使用，避免写入仍在上传中的PBO
+#define NB_PBO 2
 
 static GLFWwindow *window;
-static uint texture = -1, program = -1;
+/**
+ * 每个平面一个纹理：RGB只用第一个；YUV分别为Y、U、V；NV12为Y、UV
+ */
+static uint textures[3], program = -1;
+/**
+ * 纹理当前分配的尺寸和格式，只在变化时重新分配，其余时候只更新内容
+ */
+static struct {
+    int width, height, internal_format;
+} texture_info[3];
+/**
+ * 上传纹理用的PBO及其大小，每次上传新帧时切换到下一组
+ */
+static uint pbos[NB_PBO][3];
+static int pbo_sizes[NB_PBO][3];
+static int pbo_index = 0;
+static int u_format, u_yuv_matrix, u_yuv_offset;
 static uint vao, vbo;
 static float shaderBuffer[(3 + 2) * 4] = {
     -1, 1,  0, 0, 0,  // left-top
@@ -72,22 +118,91 @@ static uint compile_shader(const char *code, uint type) {
 static void on_key_event(GLFWwindow *win, int key, int scancode, int action,
                          int mods);
 
-static void init_render() {
-    queue_init(&to_render);
-    glfwInit();
+/**
+ * 在每次VSync（SwapBuffers返回或模拟的VSync）之后调用
+ */
+static void publish_vsync(int64_t time) {
+    atomic_store(&last_vsync, time);
+}
+
+int64_t render_commit_deadline(int64_t target) {
+    int64_t last = atomic_load(&last_vsync);
+    int64_t period = atomic_load(&vsync_period);
+    if (last <= 0 || period <= 0 || target <= last) {
+        return target;
+    }
+    // target之后第一个VSync的前一个VSync
+    int64_t n = (target - last + period - 1) / period;
+    return last + (n - 1) * period - PRESENT_COMMIT_MARGIN;
+}
+
+void set_video_sink(enum VideoSink sink) {
+    video_sink = sink;
+}
+
+/**
+ * 没有X11/Wayland显示服务时，离屏模式使用GLFW的null平台，
+ * 通过EGL（surfaceless）创建GL上下文，不需要窗口系统
+ */
+static int use_headless_platform() {
+#ifdef GLFW_PLATFORM_NULL
+    return video_sink == VIDEO_SINK_OFFSCREEN && !getenv("DISPLAY") &&
+           !getenv("WAYLAND_DISPLAY");
+#else
+    return 0;
+#endif
+}
+
+/**
+ * 创建GL上下文并初始化渲染资源；离屏模式下无法创建上下文时返回0，
+ * 窗口模式下直接退出
+ */
+static int init_render() {
+    int headless = use_headless_platform();
+#ifdef GLFW_PLATFORM_NULL
+    if (headless) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
+    if (!glfwInit()) {
+        logRenderE("failed to initialize glfw\n");
+        if (video_sink == VIDEO_SINK_OFFSCREEN) {
+            return 0;
+        }
+        exit(-1);
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    if (headless) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
 
+    // 离屏模式下窗口始终隐藏，只用来持有GL上下文
     window = glfwCreateWindow(1000, 1000, "SimplePlayer", NULL, NULL);
     if (window == NULL) {
-        logRenderE("failed to create window\n");
+        logRenderE("failed to create window%s\n",
+                   headless ? " (headless EGL)" : "");
         glfwTerminate();
+        if (video_sink == VIDEO_SINK_OFFSCREEN) {
+            return 0;
+        }
         exit(-1);
     }
     glfwMakeContextCurrent(window);
-    glfwSetKeyCallback(window, on_key_event);
+    if (video_sink == VIDEO_SINK_WINDOW) {
+        glfwSetKeyCallback(window, on_key_event);
+        glfwSwapInterval(1);
+        const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        int refresh_rate = mode && mode->refreshRate > 0
+                               ? mode->refreshRate
+                               : SIMULATED_REFRESH_RATE;
+        atomic_store(&vsync_period, 1000 * 1000 / refresh_rate);
+    } else {
+        // 呈现节奏由模拟的VSync控制，不能再被SwapBuffers阻塞
+        glfwSwapInterval(0);
+    }
 
     if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
         logRenderE("failed to initialize opengl\n");
@@ -114,9 +229,27 @@ static void init_render() {
     code =
         "#version 330 core\n"
         "in vec2 vTexPos;\n"
-        "uniform sampler2D tex;\n"
+        "out vec4 fragColor;\n"
+        "uniform sampler2D tex0;\n"
+        "uniform sampler2D tex1;\n"
+        "uniform sampler2D tex2;\n"
+        "uniform int format;\n"
+        "uniform mat3 yuvMatrix;\n"
+        "uniform vec3 yuvOffset;\n"
         "void main() {\n"
-        "    gl_FragColor = texture(tex, vTexPos);\n"
+        "    if (format == 0) {\n"
+        "        fragColor = vec4(texture(tex0, vTexPos).rgb, 1.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    vec3 yuv;\n"
+        "    yuv.x = texture(tex0, vTexPos).r;\n"
+        "    if (format == 1) {\n"
+        "        yuv.y = texture(tex1, vTexPos).r;\n"
+        "        yuv.z = texture(tex2, vTexPos).r;\n"
+        "    } else {\n"
+        "        yuv.yz = texture(tex1, vTexPos).rg;\n"
+        "    }\n"
+        "    fragColor = vec4(yuvMatrix * (yuv - yuvOffset), 1.0);\n"
         "}";
     logRender("compiling fragment shader:\n%s\n", code);
     fragShader = compile_shader(code, GL_FRAGMENT_SHADER);
@@ -146,28 +279,222 @@ static void init_render() {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5,
                           (void *) (sizeof(float) * 3));
 
-    glGenTextures(1, &texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; i++) {
+        char name[8];
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        // 边缘不能用REPEAT，否则线性插值会采样到另一侧的像素
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // 这里不能用枚举，只需要序号，设置为0就代表着GL_TEXTURE0
-    glUniform1i(glGetUniformLocation(program, "tex"), 0);
+        // 这里不能用枚举，只需要序号，设置为0就代表着GL_TEXTURE0
+        snprintf(name, sizeof(name), "tex%d", i);
+        glUniform1i(glGetUniformLocation(program, name), i);
+    }
+    glGenBuffers(NB_PBO * 3, &pbos[0][0]);
+    u_format = glGetUniformLocation(program, "format");
+    u_yuv_matrix = glGetUniformLocation(program, "yuvMatrix");
+    u_yuv_offset = glGetUniformLocation(program, "yuvOffset");
+    return 1;
 }
 
-static AVFrame *get_newest_frame() {
-    AVFrame *frame, *newest;
-    newest = NULL;
-    while ((frame = queue_dequeue(&to_render)) != NULL) {
-        if (newest != NULL) {
-            av_frame_free(&newest);
+static int get_render_format(enum AVPixelFormat format) {
+    switch (format) {
+        case AV_PIX_FMT_RGB24:
+            return RENDER_FORMAT_RGB;
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P:
+            return RENDER_FORMAT_YUV;
+        case AV_PIX_FMT_NV12:
+            return RENDER_FORMAT_NV12;
+        default:
+            return -1;
+    }
+}
+
+int render_format_supported(enum AVPixelFormat format) {
+    return get_render_format(format) >= 0;
+}
+
+/**
+ * 根据帧的色彩空间和范围设置YUV转RGB的矩阵
+ */
+static void set_yuv_uniforms(const AVFrame *frame) {
+    double kr, kb;
+    float matrix[9], offset[3];
+
+    switch (frame->colorspace) {
+        case AVCOL_SPC_BT709:
+            kr = COLORSPACE_BT709_KR;
+            kb = COLORSPACE_BT709_KB;
+            break;
+        case AVCOL_SPC_BT2020_NCL:
+        case AVCOL_SPC_BT2020_CL:
+            kr = COLORSPACE_BT2020_KR;
+            kb = COLORSPACE_BT2020_KB;
+            break;
+        case AVCOL_SPC_BT470BG:
+        case AVCOL_SPC_SMPTE170M:
+        case AVCOL_SPC_FCC:
+            kr = COLORSPACE_BT601_KR;
+            kb = COLORSPACE_BT601_KB;
+            break;
+        default:
+            // 未指定时按分辨率猜测，高清内容通常是BT.709
+            if (frame->height >= 720) {
+                kr = COLORSPACE_BT709_KR;
+                kb = COLORSPACE_BT709_KB;
+            } else {
+                kr = COLORSPACE_BT601_KR;
+                kb = COLORSPACE_BT601_KB;
+            }
+    }
+    int full_range = frame->color_range == AVCOL_RANGE_JPEG ||
+                     frame->format == AV_PIX_FMT_YUVJ420P ||
+                     frame->format == AV_PIX_FMT_YUVJ422P ||
+                     frame->format == AV_PIX_FMT_YUVJ444P;
+    colorspace_yuv_to_rgb(kr, kb, full_range, matrix, offset);
+    // matrix按行存储，需要转置
+    glUniformMatrix3fv(u_yuv_matrix, 1, GL_TRUE, matrix);
+    glUniform3fv(u_yuv_offset, 1, offset);
+}
+
+/**
+ * 根据linesize设置解包参数，使GL直接按AVFrame的行跨度读取数据，
+ * 不需要把每一行重新排列成紧密的格式。返回0表示无法用解包参数表示
+ */
+static int set_unpack_stride(int width, int linesize, int bytes_per_pixel) {
+    if (linesize % bytes_per_pixel == 0) {
+        // 行跨度是像素的整数倍，直接作为ROW_LENGTH，对齐取能整除的最大值
+        int alignment = 8;
+        while (linesize % alignment != 0) {
+            alignment >>= 1;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, linesize / bytes_per_pixel);
+        return 1;
+    }
+    // 否则只能靠对齐来表示行末的填充（如RGB24）
+    for (int alignment = 8; alignment > 1; alignment >>= 1) {
+        if (FFALIGN(width * bytes_per_pixel, alignment) == linesize) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            return 1;
         }
-        newest = frame;
     }
-    return newest;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    return 0;
+}
+
+/**
+ * 通过PBO异步上传一个平面：先把数据复制到PBO，再由驱动从PBO更新纹理，
+ * glTexSubImage2D不需要等待传输完成
+ */
+static void upload_plane(int index, int internal_format, int format, int width,
+                         int height, const uint8_t *data, int linesize,
+                         int bytes_per_pixel) {
+    int row_bytes = width * bytes_per_pixel;
+    int keep_stride = set_unpack_stride(width, linesize, bytes_per_pixel);
+    int size = keep_stride ? linesize * height : row_bytes * height;
+
+    glActiveTexture(GL_TEXTURE0 + index);
+    glBindTexture(GL_TEXTURE_2D, textures[index]);
+    if (texture_info[index].width != width ||
+        texture_info[index].height != height ||
+        texture_info[index].internal_format != internal_format) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+                     format, GL_UNSIGNED_BYTE, NULL);
+        texture_info[index].width = width;
+        texture_info[index].height = height;
+        texture_info[index].internal_format = internal_format;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[pbo_index][index]);
+    if (pbo_sizes[pbo_index][index] != size) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        pbo_sizes[pbo_index][index] = size;
+    }
+    // INVALIDATE使驱动不需要等待上一次使用这块内存的传输完成
+    uint8_t *dst = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst == NULL) {
+        logRenderE("failed to map pixel buffer\n");
+        exit(-1);
+    }
+    if (keep_stride) {
+        // 连同行末的填充整块复制
+        memcpy(dst, data, size);
+    } else {
+        for (int y = 0; y < height; y++) {
+            memcpy(dst + y * row_bytes, data + y * linesize, row_bytes);
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format,
+                    GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+ * 按平面上传帧，YUV在片段着色器中转换为RGB
+ */
+static void upload_frame(const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int render_format = get_render_format(frame->format);
+    int width = frame->width, height = frame->height;
+    int chroma_width = AV_CEIL_RSHIFT(width, desc->log2_chroma_w);
+    int chroma_height = AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+
+    glUniform1i(u_format, render_format);
+    switch (render_format) {
+        case RENDER_FORMAT_RGB:
+            upload_plane(0, GL_RGB8, GL_RGB, width, height, frame->data[0],
+                         frame->linesize[0], 3);
+            break;
+        case RENDER_FORMAT_YUV:
+            upload_plane(0, GL_R8, GL_RED, width, height, frame->data[0],
+                         frame->linesize[0], 1);
+            upload_plane(1, GL_R8, GL_RED, chroma_width, chroma_height,
+                         frame->data[1], frame->linesize[1], 1);
+            upload_plane(2, GL_R8, GL_RED, chroma_width, chroma_height,
+                         frame->data[2], frame->linesize[2], 1);
+            set_yuv_uniforms(frame);
+            break;
+        case RENDER_FORMAT_NV12:
+            upload_plane(0, GL_R8, GL_RED, width, height, frame->data[0],
+                         frame->linesize[0], 1);
+            upload_plane(1, GL_RG8, GL_RG, chroma_width, chroma_height,
+                         frame->data[1], frame->linesize[1], 2);
+            set_yuv_uniforms(frame);
+            break;
+        default:
+            logRenderE("unsupported format for rendering: %s\n",
+                       av_get_pix_fmt_name(frame->format));
+            exit(-1);
+    }
+    pbo_index = (pbo_index + 1) % NB_PBO;
+}
+
+/**
+ * 获取最新提交的帧，没有新的帧时返回NULL；返回的帧由邮箱持有，
+ * 在下一次调用之前一直有效
+ */
+static AVFrame *get_newest_frame() {
+    if (mailbox_fetch(&to_render)) {
+        return mailbox_front(&to_render);
+    }
+    return NULL;
 }
 
 static void on_key_event(GLFWwindow *win, int key, int scancode, int action,
@@ -176,12 +503,16 @@ static void on_key_event(GLFWwindow *win, int key, int scancode, int action,
         glfwTerminate();
         // TODO 整体的状态管理（不应由视频线程退出整个进程）
         exit(-1);
-    } else if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS) {
+    } else if (key == GLFW_KEY_RIGHT &&
+               (action == GLFW_PRESS || action == GLFW_REPEAT)) {
+        // 按住Shift时精确seek，否则从关键帧开始播放；按住不放时连续seek，
+        // 由解封装线程合并
         logRender("[event] forward\n");
-        play_seek(pc, pc->audio_sc->play_time + 5 * 1000 * 1000);
-    } else if (key == GLFW_KEY_LEFT && action == GLFW_PRESS) {
+        play_seek_by(pc, 5 * 1000 * 1000, mods & GLFW_MOD_SHIFT);
+    } else if (key == GLFW_KEY_LEFT &&
+               (action == GLFW_PRESS || action == GLFW_REPEAT)) {
         logRender("[event] backword\n");
-        play_seek(pc, pc->audio_sc->play_time - 5 * 1000 * 1000);
+        play_seek_by(pc, -5 * 1000 * 1000, mods & GLFW_MOD_SHIFT);
     } else if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
         logRender("[event] toggle play state\n");
         play_toggle(pc);
@@ -191,63 +522,151 @@ static void on_key_event(GLFWwindow *win, int key, int scancode, int action,
 }
 
 /**
- * 渲染线程，同时也负责输入事件的捕获
+ * 没有窗口时模拟SIMULATED_REFRESH_RATE的VSync，等待到下一个VSync时刻。
+ * 落后超过一个周期时不追赶，从当前时间重新开始计算
  */
-static void *render_thread() {
-    logRender("[render] tid=%lu\n", pthread_self());
+static void wait_simulated_vsync() {
+    struct timespec now;
+    const int64_t period = 1000 * 1000 * 1000 / SIMULATED_REFRESH_RATE;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t nano = next_vsync.tv_nsec + period;
+    next_vsync.tv_nsec = nano % (1000 * 1000 * 1000);
+    next_vsync.tv_sec += nano / (1000 * 1000 * 1000);
+    if (now.tv_sec > next_vsync.tv_sec ||
+        (now.tv_sec == next_vsync.tv_sec &&
+         now.tv_nsec > next_vsync.tv_nsec)) {
+        next_vsync = now;
+    } else {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_vsync, NULL);
+    }
+    publish_vsync((int64_t) next_vsync.tv_sec * 1000 * 1000 +
+                  next_vsync.tv_nsec / 1000);
+}
+
+/**
+ * 空渲染：不创建GL上下文，按模拟的VSync取走最新的帧并丢弃，
+ * 用于在没有显示器和GPU的机器上测试解码、转换和同步
+ */
+static void null_render_loop() {
+    while (!stop_requested) {
+        if (get_newest_frame()) {
+            presented_frames++;
+        }
+        wait_simulated_vsync();
+    }
+}
 
+/**
+ * 窗口渲染和离屏渲染
+ */
+static void gl_render_loop() {
     // TODO 等待渲染线程就绪之后，视频播放线程再开始工作
-    init_render();
+    if (!init_render()) {
+        // 离屏模式下无法创建GL上下文（如没有显示服务，也没有可用的EGL），
+        // 退回到空渲染，保证播放流程可以继续
+        logRenderE("offscreen rendering unavailable, fallback to null sink\n");
+        video_sink = VIDEO_SINK_NULL;
+        null_render_loop();
+        return;
+    }
 
-    AVFrame *curr_frame = NULL;
+    // 只记录尺寸，旧的帧在取新帧之后可能已经被生产者复用
+    int frame_width = 0, frame_height = 0;
 
-    while (!glfwWindowShouldClose(window) && !stop_requested) {
-        glfwPollEvents();
+    while (!stop_requested) {
+        if (video_sink == VIDEO_SINK_WINDOW) {
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
+            glfwPollEvents();
+            if (glfwGetWindowAttrib(window, GLFW_VISIBLE) == GLFW_FALSE) {
+                glfwShowWindow(window);
+            }
+        }
         /* logRender("[render] rendering frame...\n"); */
 
-        if (glfwGetWindowAttrib(window, GLFW_VISIBLE) == GLFW_FALSE) {
-            glfwShowWindow(window);
-        }
         glClearColor(0, 0, 0, 1);
         glClear(GL_COLOR_BUFFER_BIT);
 
+        // 只在有新帧时上传纹理，纹理内容在两次上传之间保持不变，
+        // 但每次SwapBuffers之前仍然需要重绘
         AVFrame *new_frame = get_newest_frame();
         if (new_frame) {
-            av_frame_free(&curr_frame);
-            curr_frame = new_frame;
+            if (new_frame->width != frame_width ||
+                new_frame->height != frame_height) {
+                frame_width = new_frame->width;
+                frame_height = new_frame->height;
+                glfwSetWindowSize(window, frame_width, frame_height);
+                glViewport(0, 0, frame_width, frame_height);
+            }
+            upload_frame(new_frame);
+            presented_frames++;
         }
-        if (curr_frame) {
-            // TODO 目前每帧都是全量更新的，是否可以优化成
-            // 按需更新（关键在于如何处理SwapBuffers）
-            glfwSetWindowSize(window, curr_frame->width, curr_frame->height);
-            glViewport(0, 0, curr_frame->width, curr_frame->height);
-            // TODO 这里可能要处理一下linesize和width不一致的情况
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, curr_frame->width,
-                         curr_frame->height, 0, GL_RGB, GL_UNSIGNED_BYTE,
-                         curr_frame->data[0]);
+        if (frame_width > 0) {
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
             check_gl_error();
         }
         glfwSwapBuffers(window);
-    }
-    if (curr_frame) {
-        av_frame_free(&curr_frame);
+        if (video_sink == VIDEO_SINK_OFFSCREEN) {
+            // 等待GPU完成，使离屏渲染的耗时与实际呈现一致
+            glFinish();
+            wait_simulated_vsync();
+        } else {
+            publish_vsync(clock_now());
+        }
     }
 
     glfwTerminate();
+}
+
+/**
+ * 渲染线程，窗口模式下同时也负责输入事件的捕获
+ */
+static void *render_thread() {
+    logRender("[render] tid=%lu, sink=%d\n", pthread_self(), video_sink);
+
+    clock_gettime(CLOCK_MONOTONIC, &next_vsync);
+    if (video_sink != VIDEO_SINK_WINDOW) {
+        atomic_store(&vsync_period, 1000 * 1000 / SIMULATED_REFRESH_RATE);
+    }
+    if (video_sink == VIDEO_SINK_NULL) {
+        null_render_loop();
+    } else {
+        gl_render_loop();
+    }
+    logRender("[render] finished, %ld frames presented\n", presented_frames);
     return NULL;
 }
 
 void start_render(PlayContext *ctx) {
     pc = ctx;
+    for (int i = 0; i < 3; i++) {
+        if ((render_slots[i] = av_frame_alloc()) == NULL) {
+            averror(AVERROR_UNKNOWN, "alloc frame");
+        }
+    }
+    mailbox_init(&to_render, (void **) render_slots);
     pthread_create(&tid, NULL, render_thread, NULL);
 }
 
-void commit_frame(AVFrame *frame) {
-    queue_enqueue(&to_render, frame);
+void commit_frame(const AVFrame *frame) {
+    int ret;
+    AVFrame *back = mailbox_back(&to_render);
+    // back槽中可能是已经显示过或者被覆盖的帧，直接替换
+    av_frame_unref(back);
+    if ((ret = av_frame_ref(back, frame)) != 0) {
+        averror(ret, "av_frame_ref");
+    }
+    if (mailbox_publish(&to_render)) {
+        logRender("[render] frame dropped before rendering\n");
+    }
 }
 
 void stop_render() {
     stop_requested = 1;
     pthread_join(tid, NULL);
+    for (int i = 0; i < 3; i++) {
+        av_frame_free(&render_slots[i]);
+    }
 }
@@ -6,8 +6,35 @@
 
 #include "codec.h"
 
+enum VideoSink {
+    /** 在窗口中显示，由VSync驱动 */
+    VIDEO_SINK_WINDOW,
+    /** 在隐藏的窗口中离屏渲染，模拟VSync */
+    VIDEO_SINK_OFFSCREEN,
+    /** 不渲染，只按模拟的VSync取走帧 */
+    VIDEO_SINK_NULL,
+};
+
+/**
+ * 设置视频输出方式，需要在start_render之前调用
+ */
+void set_video_sink(enum VideoSink sink);
+
 void start_render(PlayContext *ctx);
-void commit_frame(AVFrame *frame);
+/**
+ * 提交一帧给渲染线程，只增加帧的引用，调用方仍持有frame
+ */
+void commit_frame(const AVFrame *frame);
 void stop_render();
+/**
+ * 计算一帧需要在什么时刻之前提交，才能在target之后的第一个VSync显示。
+ * 渲染线程在每次VSync之后取帧，所以要在该VSync的前一个VSync之前提交；
+ * 还没有VSync信息时返回target。时间都是单调时钟，单位：微秒
+ */
+int64_t render_commit_deadline(int64_t target);
+/**
+ * 渲染线程是否可以直接绘制该格式，不支持的格式需要先转换
+ */
+int render_format_supported(enum AVPixelFormat format);
 
 #endif /* ifndef _RENDER_H_ */
@@ -0,0 +1,107 @@
+#include "selector.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+static int64_t get_monotonic_microseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
+void selector_init(Selector *sel) {
+    sel->nb_items = 0;
+    sel->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sel->epoll_fd < 0) {
+        error("selector_init: epoll_create1 failed");
+    }
+}
+
+void selector_destroy(Selector *sel) {
+    close(sel->epoll_fd);
+    sel->epoll_fd = -1;
+    sel->nb_items = 0;
+}
+
+int selector_add(Selector *sel, Queue *queue, QueuePrediction pred,
+                 enum QueueWaitFor wait_for) {
+    struct epoll_event ev;
+
+    if (sel->nb_items >= SELECTOR_MAX_ITEMS) {
+        error("selector_add: too many items");
+    }
+    int index = sel->nb_items++;
+    sel->items[index] = (SelectorItem){
+        .queue = queue,
+        .pred = pred,
+        .wait_for = wait_for,
+    };
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    if (epoll_ctl(sel->epoll_fd, EPOLL_CTL_ADD,
+                  queue_get_wait_fd(queue, wait_for), &ev) != 0) {
+        error("selector_add: epoll_ctl failed");
+    }
+    return index;
+}
+
+static void drain_wait_fd(const SelectorItem *item) {
+    uint64_t count;
+    // 非阻塞的eventfd，没有通知时返回EAGAIN
+    while (read(queue_get_wait_fd(item->queue, item->wait_for), &count,
+                sizeof(count)) > 0) {}
+}
+
+static int find_ready(Selector *sel) {
+    for (int i = 0; i < sel->nb_items; i++) {
+        SelectorItem *item = &sel->items[i];
+        if (queue_ready(item->queue, item->pred, item->wait_for)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int selector_wait(Selector *sel, int64_t microseconds) {
+    struct epoll_event events[SELECTOR_MAX_ITEMS];
+    int64_t deadline = get_monotonic_microseconds() + microseconds;
+    int ready;
+
+    // 快速路径：已经有队列就绪时不需要进入epoll
+    if ((ready = find_ready(sel)) >= 0) {
+        return ready;
+    }
+    for (int i = 0; i < sel->nb_items; i++) {
+        queue_watch(sel->items[i].queue, sel->items[i].wait_for);
+    }
+    for (;;) {
+        // 先清空通知再检查条件，检查之后发生的变化一定会使eventfd可读
+        for (int i = 0; i < sel->nb_items; i++) {
+            drain_wait_fd(&sel->items[i]);
+        }
+        if ((ready = find_ready(sel)) >= 0) {
+            break;
+        }
+        int timeout = -1;
+        if (microseconds >= 0) {
+            int64_t remain = deadline - get_monotonic_microseconds();
+            if (remain <= 0) {
+                break;
+            }
+            timeout = (remain + 999) / 1000;
+        }
+        if (epoll_wait(sel->epoll_fd, events, SELECTOR_MAX_ITEMS, timeout) <
+                0 &&
+            errno != EINTR) {
+            error("selector_wait: epoll_wait failed");
+        }
+    }
+    for (int i = 0; i < sel->nb_items; i++) {
+        queue_unwatch(sel->items[i].queue, sel->items[i].wait_for);
+    }
+    return ready;
+}
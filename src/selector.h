@@ -0,0 +1,40 @@
+#ifndef _SELECTOR_H_
+#define _SELECTOR_H_
+
+#include "queue.h"
+
+// 一个selector最多可以同时等待的队列数量
+#define SELECTOR_MAX_ITEMS 4
+
+typedef struct {
+    Queue *queue;
+    QueuePrediction pred;
+    enum QueueWaitFor wait_for;
+} SelectorItem;
+
+/**
+ * 同时等待多个队列，任意一个队列就绪时返回
+ *
+ * 基于队列的wait fd和epoll实现，使得一个线程可以同时阻塞在
+ * “数据队列就绪”和“事件队列非空”上，而不需要定时唤醒轮询。
+ * 同一个selector只能在一个线程中使用。
+ */
+typedef struct {
+    int epoll_fd;
+    int nb_items;
+    SelectorItem items[SELECTOR_MAX_ITEMS];
+} Selector;
+
+void selector_init(Selector *sel);
+void selector_destroy(Selector *sel);
+/**
+ * 添加一个等待的队列，返回其序号；多个队列同时就绪时，先添加的优先
+ */
+int selector_add(Selector *sel, Queue *queue, QueuePrediction pred,
+                 enum QueueWaitFor wait_for);
+/**
+ * 等待直到某个队列就绪，返回该队列的序号；超时返回-1，microseconds小于0时一直等待
+ */
+int selector_wait(Selector *sel, int64_t microseconds);
+
+#endif /* ifndef _SELECTOR_H_ */
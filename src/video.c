@@ -6,10 +6,12 @@
 
 #include <GLFW/glfw3.h>
 #include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/time.h>
 #include <libswscale/swscale.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "config.h"
 #include "event.h"
@@ -17,59 +19,212 @@
 #include "render.h"
 #include "utils.h"
 
-// TODO 用OpenGL实现 / OpenGL渲染YUV
-static AVFrame *convert_frame_to_rgb24(const AVFrame *frame) {
+/**
+ * 转换线程使用的SwsContext和输出帧的缓冲池，只在帧的尺寸、格式变化时重新创建
+ */
+// 转换输出帧的行对齐，渲染线程会按linesize上传，不需要紧密排列。
+// RGB24的行跨度只有能被3整除，或者等于按不超过8字节对齐的行宽时，
+// 才能用GL的解包参数表示，所以RGB24只按8字节对齐
+#define OUT_FRAME_ALIGN 32
+#define OUT_FRAME_ALIGN_RGB24 8
+
+static struct SwsContext *sws_ctx = NULL;
+/**
+ * sws_ctx当前对应的输入帧参数和设置的色彩范围，只在变化时重新设置
+ * （sws_getCachedContext在输入参数变化时会重建上下文）
+ */
+static int sws_width = 0, sws_height = 0, sws_format = -1;
+static int sws_full_range = -1;
+static AVBufferPool *out_pool = NULL;
+static int out_pool_size = 0;
+
+static void free_frame(AVFrame *frame) {
+    av_frame_free(&frame);
+}
+
+/**
+ * 转换为渲染线程可以直接绘制的格式
+ *
+ * 常见的YUV格式和RGB24由渲染线程在着色器中处理，这里只增加引用；
+ * 其他格式转换为YUV420P（RGB类的格式转换为RGB24）。
+ */
+static AVFrame *convert_frame_for_render(const AVFrame *frame) {
     int ret;
-    if (frame->format == AV_PIX_FMT_RGB24) {
+    if (render_format_supported(frame->format)) {
         // 复制新的AVFrame，同时共享Buffer
         AVFrame *newFrame = av_frame_alloc();
         av_frame_ref(newFrame, frame);
         return newFrame;
     }
-    logRender("frame is in %s format, not rgb24, converting...\n",
-              av_get_pix_fmt_name(frame->format));
-    struct SwsContext *sc = sws_getContext(
-        frame->width, frame->height, frame->format, frame->width, frame->height,
-        AV_PIX_FMT_RGB24, SWS_SPLINE, NULL, NULL, NULL);
-    if (sc == NULL) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    enum AVPixelFormat out_format = desc->flags & AV_PIX_FMT_FLAG_RGB
+                                        ? AV_PIX_FMT_RGB24
+                                        : AV_PIX_FMT_YUV420P;
+    sws_ctx = sws_getCachedContext(
+        sws_ctx, frame->width, frame->height, frame->format, frame->width,
+        frame->height, out_format, SWS_SPLINE, NULL, NULL, NULL);
+    if (sws_ctx == NULL) {
         logCodecE("convert failed\n");
         exit(-1);
     }
+    if (frame->width != sws_width || frame->height != sws_height ||
+        frame->format != sws_format) {
+        // 上下文已经重建，需要重新设置色彩范围
+        sws_width = frame->width;
+        sws_height = frame->height;
+        sws_format = frame->format;
+        sws_full_range = -1;
+    }
+
+    int align = out_format == AV_PIX_FMT_RGB24 ? OUT_FRAME_ALIGN_RGB24
+                                               : OUT_FRAME_ALIGN;
+    int size = av_image_get_buffer_size(out_format, frame->width,
+                                        frame->height, align);
+    if (size != out_pool_size) {
+        // 已经分配出去的Buffer在释放之后才会真正销毁旧的缓冲池
+        logRender("frame is in %s format, converting to %s with %dx%d\n",
+                  av_get_pix_fmt_name(frame->format),
+                  av_get_pix_fmt_name(out_format), frame->width,
+                  frame->height);
+        av_buffer_pool_uninit(&out_pool);
+        out_pool = av_buffer_pool_init(size, NULL);
+        out_pool_size = size;
+    }
 
     AVFrame *outFrame = av_frame_alloc();
     av_frame_copy_props(outFrame, frame);
     outFrame->width = frame->width;
     outFrame->height = frame->height;
-    outFrame->format = AV_PIX_FMT_RGB24;
-    if ((ret = av_frame_get_buffer(outFrame, 1)) != 0) {
-        averror(ret, "av_frame_get_buffer");
+    outFrame->format = out_format;
+    if (out_format == AV_PIX_FMT_YUV420P) {
+        // sws_scale不读取帧上的范围标记，需要显式告诉它输入的范围，
+        // 输出保持相同的范围，并与实际的输出一致地标记在帧上
+        int full_range = frame->color_range == AVCOL_RANGE_JPEG ||
+                         frame->format == AV_PIX_FMT_YUVJ411P ||
+                         frame->format == AV_PIX_FMT_YUVJ440P;
+        if (full_range != sws_full_range) {
+            const int *coefs = sws_getCoefficients(SWS_CS_DEFAULT);
+            sws_setColorspaceDetails(sws_ctx, coefs, full_range, coefs,
+                                     full_range, 0, 1 << 16, 1 << 16);
+            sws_full_range = full_range;
+        }
+        outFrame->color_range =
+            full_range ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+    }
+    if ((outFrame->buf[0] = av_buffer_pool_get(out_pool)) == NULL) {
+        averror(AVERROR(ENOMEM), "av_buffer_pool_get");
+    }
+    if ((ret = av_image_fill_arrays(outFrame->data, outFrame->linesize,
+                                    outFrame->buf[0]->data, out_format,
+                                    frame->width, frame->height,
+                                    align)) < 0) {
+        averror(ret, "av_image_fill_arrays");
     }
 
-    sws_scale(sc, (const uint8_t *const *) frame->data, frame->linesize, 0,
-              frame->height, outFrame->data, outFrame->linesize);
-
-    sws_freeContext(sc);
+    sws_scale(sws_ctx, (const uint8_t *const *) frame->data, frame->linesize,
+              0, frame->height, outFrame->data, outFrame->linesize);
     return outFrame;
 }
 
-static inline int64_t get_frame_duration(AVCodecContext *cc) {
-    return av_rescale_q(1000 * 1000, (AVRational){1, 1}, cc->framerate);
+/**
+ * 帧的显示时长，解码线程已经为每帧补全了pkt_duration，单位：微秒
+ */
+static inline int64_t get_frame_duration(const StreamContext *sc,
+                                         const AVFrame *frame) {
+    return pts_to_microseconds(sc, frame->pkt_duration);
 }
 
-static void update(StreamContext *ctx, const AVFrame *frame) {
-    commit_frame(convert_frame_to_rgb24(frame));
+static void sleep_until(int64_t time) {
+    struct timespec ts = {
+        .tv_sec = time / (1000 * 1000),
+        .tv_nsec = time % (1000 * 1000) * 1000,
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
 
-    av_usleep(get_frame_duration(ctx->cc));
+/**
+ * 计算帧的目标显示时刻（单调时钟），即主时钟走到pts的时刻
+ *
+ * 视频为主时钟时，视频时钟是按上一帧的目标时刻发布的，所以这里相当于上一帧
+ * 的目标时刻加上两帧pts的差值，每帧提交时的误差不会累积；视频时钟没有在走时
+ * （刚开始或seek之后），以当前时刻为起点
+ */
+static int64_t get_frame_target(PlayContext *pc, int64_t pts, int64_t now) {
+    if (pc->clock_master == CLOCK_MASTER_VIDEO &&
+        !clock_is_running(&pc->video_sc->clock)) {
+        return now;
+    }
+    return now + pts - get_master_clock(pc);
+}
+
+/**
+ * 按绝对时刻等待，直到需要提交帧的时刻，在target中返回最终的目标显示时刻
+ *
+ * 每次最多等待SYNC_MAX_WAIT_FRAMES帧，之后根据主时钟重新计算目标时刻，
+ * 以免主时钟变化（如音频卡顿）时等待过久；总共最多等待SYNC_MAX_WAIT，
+ * 之后以当前时刻为目标直接提交。
+ *
+ * 等待期间发生seek时这一帧已经过期，返回0，由调用者丢弃；其他事件（如暂停）
+ * 在这里处理，暂停时等到恢复，之后保留这一帧，重新计算目标时刻继续等待
+ */
+static int wait_for_present(PlayContext *pc, const AVFrame *frame, int64_t pts,
+                            int64_t *target) {
+    StreamContext *sc = pc->video_sc;
+    int64_t max_wait = get_frame_duration(sc, frame) * SYNC_MAX_WAIT_FRAMES;
+    int64_t give_up = clock_now() + SYNC_MAX_WAIT;
+    // seek时转换线程会清空转换队列，代数变化说明这一帧已经过期
+    unsigned int epoch = queue_epoch(&sc->convert_queue);
+    for (;;) {
+        if (pc->state == STATE_PLAY_SEEKING ||
+            pc->state == STATE_PAUSE_SEEKING) {
+            return 0;
+        }
+        if (queue_has_data(&sc->play_event_queue)) {
+            process_play_events(sc, NULL, NULL, NULL);
+            if (queue_epoch(&sc->convert_queue) != epoch) {
+                return 0;
+            }
+            give_up = clock_now() + SYNC_MAX_WAIT;
+            *target = get_frame_target(pc, pts, clock_now());
+            continue;
+        }
+        int64_t now = clock_now();
+        int64_t deadline = render_commit_deadline(*target);
+        if (deadline <= now) {
+            return 1;
+        }
+        if (now >= give_up) {
+            *target = now;
+            return 1;
+        }
+        int64_t wake = FFMIN(deadline, give_up);
+        if (max_wait > 0) {
+            wake = FFMIN(wake, now + max_wait);
+        }
+        sleep_until(wake);
+        if (pc->clock_master != CLOCK_MASTER_VIDEO) {
+            *target = get_frame_target(pc, pts, clock_now());
+        }
+    }
+}
+
+static void present(StreamContext *sc, const AVFrame *frame, int64_t pts,
+                    int64_t target) {
+    commit_frame(frame);
+    // 视频时钟按目标时刻发布；落后太多时以当前时刻为准，
+    // 避免之后连续快速提交来追赶
+    int64_t now = clock_now();
+    clock_update_at(&sc->clock, pts, 1,
+                    now - target >= SYNC_DIFF_THRESHOLD ? now : target);
 }
 
 void *video_play_thread(PlayContext *pc) {
     AVFrame *frame;
     Queue *q;
     StreamContext *sc = pc->video_sc;
-    StreamContext *audio_sc = pc->audio_sc;
 
     logRender("[video-play] tid=%lu\n", pthread_self());
-    q = &sc->frame_queue;
+    q = &sc->convert_queue;
 
     for (;;) {
         frame = queue_dequeue_wait(q, queue_has_data);
@@ -77,30 +232,37 @@ void *video_play_thread(PlayContext *pc) {
             logRender("[video-play] EOS\n");
             break;
         }
-        sc->play_time = pts_to_microseconds(sc, frame->pts);
-        logRender("[video-play] time updated: curr_time=%f\n",
-                  sc->play_time / 1000.0 / 1000);
+        int64_t pts = pts_to_microseconds(sc, frame->pts);
+        logRender("[video-play] time updated: curr_time=%f, duration=%ld\n",
+                  pts / 1000.0 / 1000, get_frame_duration(sc, frame));
 
+        int64_t target = clock_now();
         if (pc->state != STATE_PLAY_SEEKING &&
-            pc->state != STATE_PAUSE_SEEKING && audio_sc) {
-            int64_t diff = sc->play_time - pc->audio_sc->play_time;
-            if (diff <= -SYNC_DIFF_THRESHOLD) {
+            pc->state != STATE_PAUSE_SEEKING) {
+            if (pc->clock_master == CLOCK_MASTER_EXTERNAL) {
+                sync_external_clock(pc, pts);
+            }
+            int64_t now = target;
+            target = get_frame_target(pc, pts, now);
+            // 视频为主时钟时不丢帧，落后时直接提交
+            if (target - now <= -SYNC_DIFF_THRESHOLD &&
+                pc->clock_master != CLOCK_MASTER_VIDEO) {
                 logRender("[video-play] syncing, skipping frame, diff=%ld\n",
-                          diff);
-            } else if (diff >= SYNC_DIFF_THRESHOLD) {
-                logRender(
-                    "[video-play] syncing, waiting for frame render, "
-                    "diff=%ld\n",
-                    diff);
-                int64_t max_wait = get_frame_duration(sc->cc) * SYNC_MAX_WAIT_FRAMES;
-                av_usleep(max_wait < diff ? max_wait : diff);
-                update(sc, frame);
-            } else {
-                update(sc, frame);
+                          target - now);
+                report_frame_lateness(sc, 1);
+                av_frame_free(&frame);
+                process_play_events(sc, NULL, NULL, NULL);
+                continue;
+            }
+            if (!wait_for_present(pc, frame, pts, &target)) {
+                logRender("[video-play] interrupted, dropping frame\n");
+                av_frame_free(&frame);
+                process_play_events(sc, NULL, NULL, NULL);
+                continue;
             }
-        } else {
-            update(sc, frame);
+            report_frame_lateness(sc, 0);
         }
+        present(sc, frame, pts, target);
         av_frame_free(&frame);
 
         process_play_events(sc, NULL, NULL, NULL);
@@ -109,3 +271,101 @@ void *video_play_thread(PlayContext *pc) {
 
     return NULL;
 }
+
+static void process_convert_event(StreamContext *sc) {
+    for (int i = 0; i < MAX_EVENTS_PER_LOOP; i++) {
+        Event *event = queue_dequeue(&sc->convert_event_queue);
+        if (!event) {
+            break;
+        }
+        logRender("[event-convert] get type %d\n", event->type);
+        switch (event->type) {
+            case EVENT_SEEK_START: {
+                // 由生产者清空转换队列，等解码线程清空帧队列之后再继续
+                queue_clear(&sc->convert_queue, (DataCleaner) free_frame);
+                Event *seek_end =
+                    wait_for_event(&sc->convert_event_queue, EVENT_SEEK_END);
+                dispatch_play_event(sc, seek_end);
+                event_unref(seek_end);
+            } break;
+            default:
+                break;
+        }
+        event_unref(event);
+    }
+}
+
+/**
+ * 帧是否已经落后主时钟，判断方式与播放线程丢帧一致
+ */
+static int is_frame_late(PlayContext *pc, const AVFrame *frame) {
+    if (pc->clock_master == CLOCK_MASTER_VIDEO ||
+        pc->state == STATE_PLAY_SEEKING || pc->state == STATE_PAUSE_SEEKING) {
+        return 0;
+    }
+    int64_t pts = pts_to_microseconds(pc->video_sc, frame->pts);
+    return pts - get_master_clock(pc) <= -SYNC_DIFF_THRESHOLD;
+}
+
+static int convert_can_queue(Queue *q) {
+    return q->length < CONVERT_QUEUE_SIZE;
+}
+
+void *video_convert_thread(PlayContext *pc) {
+    StreamContext *sc = pc->video_sc;
+    Selector in_sel, out_sel;
+
+    logRender("[video-convert] tid=%lu\n", pthread_self());
+    // 事件队列优先
+    selector_init(&in_sel);
+    selector_add(&in_sel, &sc->convert_event_queue, queue_has_data,
+                 QUEUE_WAIT_DEQUEUE);
+    selector_add(&in_sel, &sc->frame_queue, queue_has_data,
+                 QUEUE_WAIT_DEQUEUE);
+    selector_init(&out_sel);
+    selector_add(&out_sel, &sc->convert_event_queue, queue_has_data,
+                 QUEUE_WAIT_DEQUEUE);
+    selector_add(&out_sel, &sc->convert_queue, convert_can_queue,
+                 QUEUE_WAIT_ENQUEUE);
+
+    for (;;) {
+        // 转换期间发生seek时，转换队列的代数会变化，转换出的帧会被丢弃
+        unsigned int epoch;
+        AVFrame *frame;
+        // 帧队列可能在唤醒之后、出队之前被解码线程清空，这时重新等待
+        do {
+            while (selector_wait(&in_sel, -1) == 0) {
+                process_convert_event(sc);
+            }
+            epoch = queue_epoch(&sc->convert_queue);
+        } while (!queue_try_dequeue(&sc->frame_queue, (void **) &frame));
+        if (!frame) {
+            logRender("[video-convert] EOS\n");
+            queue_enqueue_wait(&sc->convert_queue, NULL, convert_can_queue);
+            break;
+        }
+        if (is_frame_late(pc, frame)) {
+            // 已经落后的帧在转换之前就丢弃，省去转换的开销
+            report_frame_lateness(sc, 1);
+            av_frame_free(&frame);
+            continue;
+        }
+        AVFrame *out_frame = convert_frame_for_render(frame);
+        av_frame_free(&frame);
+
+        while (selector_wait(&out_sel, -1) == 0) {
+            process_convert_event(sc);
+        }
+        queue_enqueue_tagged(&sc->convert_queue, out_frame, epoch,
+                             (DataCleaner) free_frame);
+    }
+
+    selector_destroy(&in_sel);
+    selector_destroy(&out_sel);
+    sws_freeContext(sws_ctx);
+    sws_ctx = NULL;
+    sws_format = sws_full_range = -1;
+    av_buffer_pool_uninit(&out_pool);
+    logRender("[video-convert] finished\n");
+    return NULL;
+}
@@ -5,6 +5,7 @@
 
 #include "codec.h"
 
+void *video_convert_thread(PlayContext *pc);
 void *video_play_thread(PlayContext *pc);
 void *render_thread();
 
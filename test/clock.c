@@ -0,0 +1,64 @@
+#include <pthread.h>
+
+#include "../src/clock.h"
+#include "../src/utils.h"
+
+#define CLOCK_WRITES 100000
+
+void *test_clock_writer(Clock *c) {
+    // pts与updated_at始终相等，读者读到的快照如果不完整，外推的结果就会不为0
+    for (int64_t i = 1; i <= CLOCK_WRITES; i++) {
+        clock_update_at(c, i * 1000, 1, i * 1000);
+    }
+    return NULL;
+}
+
+void test_clock() {
+    Clock c;
+    clock_init(&c);
+
+    // 未开始时不推进
+    assert(!clock_is_set(&c));
+    assert(clock_get_at(&c, 1000) == 0);
+    assert(clock_get(&c) == 0);
+
+    clock_update_at(&c, 5000, 1, 1000);
+    assert(clock_is_set(&c));
+    assert(clock_get_at(&c, 1000) == 5000);
+    assert(clock_get_at(&c, 3000) == 7000);
+
+    clock_update_at(&c, 5000, 2, 1000);
+    assert(clock_get_at(&c, 3000) == 9000);
+
+    // 暂停之后停在暂停时的时间
+    assert(clock_is_running(&c));
+    clock_update_at(&c, 5000, 0, 1000);
+    assert(clock_get_at(&c, 3000) == 5000);
+    assert(!clock_is_running(&c));
+
+    // 暂停时调整速率不改变时间
+    clock_update(&c, 5000, 0);
+    clock_set_speed(&c, 0);
+    assert(clock_get(&c) == 5000);
+
+    clock_invalidate(&c, 8000);
+    assert(!clock_is_set(&c));
+    assert(clock_get_at(&c, 100000) == 8000);
+    // 只有未开始时才能开始，速率保持暂停时的0
+    assert(clock_start(&c, 9000));
+    assert(!clock_start(&c, 10000));
+    assert(clock_get(&c) == 9000);
+    clock_set_speed(&c, 1);
+    assert(clock_get(&c) >= 9000);
+
+    // 并发读写
+    pthread_t t;
+    clock_update_at(&c, 0, 1, 0);
+    pthread_create(&t, NULL, (void *) test_clock_writer, &c);
+    for (int i = 0; i < CLOCK_WRITES; i++) {
+        assert(clock_get_at(&c, 0) == 0);
+    }
+    pthread_join(t, NULL);
+    assert(clock_get_at(&c, 0) == 0);
+    clock_destroy(&c);
+}
@@ -0,0 +1,49 @@
+#include "../src/colorspace.h"
+#include "../src/utils.h"
+
+static void yuv_to_rgb(const float matrix[9], const float offset[3], int y,
+                       int u, int v, float rgb[3]) {
+    float yuv[3] = {y / 255.0f - offset[0], u / 255.0f - offset[1],
+                    v / 255.0f - offset[2]};
+    for (int i = 0; i < 3; i++) {
+        rgb[i] = matrix[i * 3] * yuv[0] + matrix[i * 3 + 1] * yuv[1] +
+                 matrix[i * 3 + 2] * yuv[2];
+    }
+}
+
+static int near(float a, float b) {
+    return a - b < 0.01f && b - a < 0.01f;
+}
+
+static int rgb_near(const float rgb[3], float r, float g, float b) {
+    return near(rgb[0], r) && near(rgb[1], g) && near(rgb[2], b);
+}
+
+void test_colorspace() {
+    float matrix[9], offset[3], rgb[3];
+
+    // 有限范围：16是黑色，235是白色
+    colorspace_yuv_to_rgb(COLORSPACE_BT601_KR, COLORSPACE_BT601_KB, 0, matrix,
+                          offset);
+    yuv_to_rgb(matrix, offset, 16, 128, 128, rgb);
+    assert(rgb_near(rgb, 0, 0, 0));
+    yuv_to_rgb(matrix, offset, 235, 128, 128, rgb);
+    assert(rgb_near(rgb, 1, 1, 1));
+    // BT.601的纯红色
+    yuv_to_rgb(matrix, offset, 81, 90, 240, rgb);
+    assert(rgb_near(rgb, 1, 0, 0));
+
+    // BT.709的纯绿色
+    colorspace_yuv_to_rgb(COLORSPACE_BT709_KR, COLORSPACE_BT709_KB, 0, matrix,
+                          offset);
+    yuv_to_rgb(matrix, offset, 173, 42, 26, rgb);
+    assert(rgb_near(rgb, 0, 1, 0));
+
+    // 完整范围：0是黑色，255是白色
+    colorspace_yuv_to_rgb(COLORSPACE_BT601_KR, COLORSPACE_BT601_KB, 1, matrix,
+                          offset);
+    yuv_to_rgb(matrix, offset, 0, 128, 128, rgb);
+    assert(rgb_near(rgb, 0, 0, 0));
+    yuv_to_rgb(matrix, offset, 255, 128, 128, rgb);
+    assert(rgb_near(rgb, 1, 1, 1));
+}
@@ -0,0 +1,47 @@
+#include <pthread.h>
+
+#include "../src/mailbox.h"
+#include "../src/utils.h"
+
+#define MAILBOX_COUNT 100000
+
+void *test_mailbox_producer(Mailbox *mb) {
+    for (long int i = 1; i <= MAILBOX_COUNT; i++) {
+        *(long int *)mailbox_back(mb) = i;
+        mailbox_publish(mb);
+    }
+    return NULL;
+}
+
+void test_mailbox() {
+    Mailbox mb;
+    long int values[3] = {0};
+    void *slots[3] = {&values[0], &values[1], &values[2]};
+
+    mailbox_init(&mb, slots);
+    assert(!mailbox_fetch(&mb));
+
+    *(long int *)mailbox_back(&mb) = 1;
+    assert(!mailbox_publish(&mb));
+    *(long int *)mailbox_back(&mb) = 2;
+    // 1还没有被取走就被覆盖了
+    assert(mailbox_publish(&mb));
+    assert(mailbox_fetch(&mb));
+    assert(*(long int *)mailbox_front(&mb) == 2);
+    assert(!mailbox_fetch(&mb));
+    assert(*(long int *)mailbox_front(&mb) == 2);
+
+    // 并发时消费者看到的值只增不减，并且最终能看到最后一个值
+    pthread_t t;
+    long int last = 2;
+    *(long int *)mailbox_back(&mb) = 0;
+    pthread_create(&t, NULL, (void *)test_mailbox_producer, &mb);
+    while (last != MAILBOX_COUNT) {
+        if (mailbox_fetch(&mb)) {
+            long int v = *(long int *)mailbox_front(&mb);
+            assert(v >= last || last == 2);
+            last = v;
+        }
+    }
+    pthread_join(t, NULL);
+}
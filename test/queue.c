@@ -7,6 +7,8 @@ int has_data(Queue *q) {
     return q->length > 0;
 }
 
+void noop_cleaner(void *data) {}
+
 void *test_consumer(Queue *q) {
     for (;;) {
         long int v = (long int)queue_dequeue_wait(q, has_data);
@@ -38,3 +40,157 @@ void test_queue() {
     pthread_join(t1, NULL);
     pthread_join(t2, NULL);
 }
+
+#define SPSC_COUNT 100000
+
+void *test_spsc_consumer(Queue *q) {
+    long int last = 0;
+    for (;;) {
+        long int v = (long int)queue_dequeue_wait(q, has_data);
+        if (v == 0) {
+            break;
+        }
+        // 生产者会清空队列，因此可能有跳跃，但一定是递增的
+        assert(v > last);
+        last = v;
+    }
+    return NULL;
+}
+
+void *test_spsc_producer(Queue *q) {
+    for (long int i = 1; i < SPSC_COUNT; i++) {
+        queue_enqueue(q, (void *)i);
+        if (i % 1000 == 0) {
+            queue_clear(q, (DataCleaner)noop_cleaner);
+        }
+    }
+    queue_enqueue(q, NULL);
+    return NULL;
+}
+
+void test_queue_spsc() {
+    Queue q;
+    void *data;
+
+    queue_init_spsc(&q, 3);
+    assert(q.capacity == 3 && q.mask == 3);
+    queue_enqueue(&q, (void *)1);
+    queue_enqueue(&q, (void *)2);
+    queue_enqueue(&q, (void *)3);
+    assert(q.length == 3);
+    assert(!queue_enqueue_timedwait(&q, (void *)4, has_data, 1000));
+    assert(queue_dequeue(&q) == (void *)1);
+    assert(queue_enqueue_timedwait(&q, (void *)4, has_data, 1000));
+    assert(queue_dequeue(&q) == (void *)2);
+    assert(queue_dequeue(&q) == (void *)3);
+    assert(queue_dequeue_timedwait(&q, has_data, 1000, &data));
+    assert(data == (void *)4);
+    assert(!queue_dequeue_timedwait(&q, has_data, 1000, &data));
+    assert(queue_dequeue(&q) == NULL);
+    // 取到NULL元素和队列为空是不同的
+    assert(!queue_try_dequeue(&q, &data));
+    queue_enqueue(&q, NULL);
+    assert(queue_try_dequeue(&q, &data) && data == NULL);
+
+    pthread_t t1, t2;
+    queue_init_spsc(&q, 16);
+    pthread_create(&t1, NULL, (void *)test_spsc_consumer, &q);
+    pthread_create(&t2, NULL, (void *)test_spsc_producer, &q);
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+    assert(q.length == 0);
+}
+
+static atomic_int clear_producer_done;
+
+void *test_clear_consumer(Queue *q) {
+    for (;;) {
+        long int v = (long int)queue_dequeue_wait(q, has_data);
+        if (v == 0) {
+            // 等待期间被清空不能被当作结束
+            assert(clear_producer_done);
+            break;
+        }
+    }
+    return NULL;
+}
+
+void *test_clear_producer(Queue *q) {
+    for (long int i = 1; i < SPSC_COUNT; i++) {
+        queue_enqueue(q, (void *)i);
+        queue_clear(q, (DataCleaner)noop_cleaner);
+    }
+    clear_producer_done = 1;
+    queue_enqueue(q, NULL);
+    return NULL;
+}
+
+/**
+ * 消费者阻塞等待期间，生产者清空队列
+ */
+void test_queue_spsc_clear() {
+    Queue q;
+
+    pthread_t t1, t2;
+    queue_init_spsc(&q, 16);
+    clear_producer_done = 0;
+    pthread_create(&t1, NULL, (void *)test_clear_consumer, &q);
+    pthread_create(&t2, NULL, (void *)test_clear_producer, &q);
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+}
+
+void measure_value(Queue *q, const void *data, int64_t *bytes,
+                   int64_t *duration) {
+    *bytes = (long int)data;
+    *duration = (long int)data * 10;
+}
+
+void test_queue_measurer() {
+    Queue q;
+
+    queue_init_spsc(&q, 8);
+    queue_set_measurer(&q, measure_value);
+    queue_enqueue(&q, (void *)1);
+    queue_enqueue(&q, (void *)2);
+    queue_enqueue(&q, (void *)3);
+    assert(q.bytes == 6 && q.duration == 60);
+    assert(queue_dequeue(&q) == (void *)1);
+    assert(q.bytes == 5 && q.duration == 50);
+    queue_clear(&q, (DataCleaner)noop_cleaner);
+    assert(q.bytes == 0 && q.duration == 0);
+
+    queue_init(&q);
+    queue_set_measurer(&q, measure_value);
+    queue_enqueue(&q, (void *)4);
+    assert(q.bytes == 4 && q.duration == 40);
+    queue_clear(&q, (DataCleaner)noop_cleaner);
+    assert(q.bytes == 0 && q.duration == 0);
+}
+
+static int cleaned;
+
+void count_cleaner(void *data) {
+    cleaned++;
+}
+
+void test_queue_epoch() {
+    Queue queues[2];
+
+    queue_init_spsc(&queues[0], 4);
+    queue_init(&queues[1]);
+    for (int i = 0; i < 2; i++) {
+        Queue *q = &queues[i];
+        cleaned = 0;
+        unsigned int epoch = queue_epoch(q);
+        assert(queue_enqueue_tagged(q, (void *)1, epoch, count_cleaner));
+        queue_clear(q, count_cleaner);
+        assert(cleaned == 1);
+        // 清空之前产生的数据不能入队
+        assert(!queue_enqueue_tagged(q, (void *)2, epoch, count_cleaner));
+        assert(cleaned == 2 && q->length == 0);
+        epoch = queue_epoch(q);
+        assert(queue_enqueue_tagged(q, (void *)3, epoch, count_cleaner));
+        assert(queue_dequeue(q) == (void *)3);
+    }
+}
@@ -0,0 +1,55 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../src/selector.h"
+
+static int selector_has_data(Queue *q) {
+    return q->length > 0;
+}
+
+static int selector_can_queue(Queue *q) {
+    return q->length < 1;
+}
+
+static void *delayed_enqueue(Queue *q) {
+    usleep(1000 * 20);
+    queue_enqueue(q, (void *)1);
+    return NULL;
+}
+
+void test_selector() {
+    Queue event_queue, data_queue;
+    Selector sel;
+    pthread_t t;
+
+    queue_init(&event_queue);
+    queue_init_spsc(&data_queue, 1);
+    selector_init(&sel);
+    assert(selector_add(&sel, &event_queue, selector_has_data,
+                        QUEUE_WAIT_DEQUEUE) == 0);
+    assert(selector_add(&sel, &data_queue, selector_has_data,
+                        QUEUE_WAIT_DEQUEUE) == 1);
+
+    // 都没有数据时超时
+    assert(selector_wait(&sel, 1000 * 5) == -1);
+
+    // 其他线程入队之后被唤醒
+    pthread_create(&t, NULL, (void *)delayed_enqueue, &data_queue);
+    assert(selector_wait(&sel, -1) == 1);
+    pthread_join(t, NULL);
+
+    // 同时就绪时，先添加的优先
+    queue_enqueue(&event_queue, (void *)1);
+    assert(selector_wait(&sel, -1) == 0);
+    assert(queue_dequeue(&event_queue) == (void *)1);
+    assert(selector_wait(&sel, -1) == 1);
+    selector_destroy(&sel);
+
+    // 等待入队：出队之后被唤醒
+    selector_init(&sel);
+    selector_add(&sel, &data_queue, selector_can_queue, QUEUE_WAIT_ENQUEUE);
+    assert(selector_wait(&sel, 1000 * 5) == -1);
+    assert(queue_dequeue(&data_queue) == (void *)1);
+    assert(selector_wait(&sel, 1000 * 5) == 0);
+    selector_destroy(&sel);
+}
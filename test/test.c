@@ -2,10 +2,26 @@
 
 void test_list();
 void test_queue();
+void test_queue_spsc();
+void test_queue_spsc_clear();
+void test_queue_measurer();
+void test_queue_epoch();
+void test_selector();
+void test_mailbox();
+void test_colorspace();
+void test_clock();
 
 void test() {
     test_list();
     test_queue();
+    test_queue_spsc();
+    test_queue_spsc_clear();
+    test_queue_measurer();
+    test_queue_epoch();
+    test_selector();
+    test_mailbox();
+    test_colorspace();
+    test_clock();
 }
 
 int main(int argc, char *argv[]) {